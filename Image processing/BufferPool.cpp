@@ -0,0 +1,272 @@
+#include "BufferPool.h"
+#include <QString>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+//  
+
+//       ALIGNMENT   
+static void* systemAlloc(std::size_t capacity)
+{
+	void* base = nullptr;
+#ifdef _WIN32
+	base = _aligned_malloc(capacity + BufferPool::ALIGNMENT, BufferPool::ALIGNMENT);
+#else
+	if (posix_memalign(&base, BufferPool::ALIGNMENT, capacity + BufferPool::ALIGNMENT))
+		base = nullptr;
+#endif
+	if (!base)
+		throw std::bad_alloc();
+	*static_cast<std::size_t*>(base) = capacity;
+	return static_cast<char*>(base) + BufferPool::ALIGNMENT;
+}
+
+static std::size_t capacityOf(const void* data)
+{
+	return *reinterpret_cast<const std::size_t*>(static_cast<const char*>(data) - BufferPool::ALIGNMENT);
+}
+
+static void systemFree(void* data)
+{
+	void* base = static_cast<char*>(data) - BufferPool::ALIGNMENT;
+#ifdef _WIN32
+	_aligned_free(base);
+#else
+	std::free(base);
+#endif
+}
+
+//      ,    25%
+static std::size_t classSize(std::size_t bytes)
+{
+	std::size_t size = 4096;
+	while (size < bytes)
+		size <<= 1;
+	if (size == 4096)
+		return size;
+	std::size_t result = size / 2;
+	while (result < bytes)
+		result += size / 8;
+	return result;
+}
+
+//  
+
+struct BufferPool::LocalCache
+{
+	std::vector<void*> blocks;
+	LocalCache*& current;
+	bool& closed;
+	LocalCache(LocalCache*& current, bool& closed);
+	~LocalCache();
+};
+
+BufferPool::LocalCache::LocalCache(LocalCache*& current, bool& closed) : current(current), closed(closed)
+{
+	blocks.reserve(LOCAL_BLOCKS);
+	current = this;
+}
+
+//       
+BufferPool::LocalCache::~LocalCache()
+{
+	current = nullptr;
+	closed = true;
+	for (void* block : blocks)
+		BufferPool::instance().pushFree(block);
+}
+
+BufferPool::LocalCache* BufferPool::threadCache(bool create)
+{
+	//       ,      
+	static thread_local LocalCache* current = nullptr;
+	static thread_local bool closed = false;
+	if (create && !current && !closed) {
+		static thread_local LocalCache cache(current, closed);
+		(void)cache;
+	}
+	return current;
+}
+
+// 
+
+BufferPool& BufferPool::instance()
+{
+	//  :          
+	static BufferPool* pool = new BufferPool;
+	return *pool;
+}
+
+void* BufferPool::acquire(std::size_t bytes)
+{
+	std::size_t capacity = classSize(bytes);
+	requests++;
+	void* data = nullptr;
+	LocalCache* cache = capacity <= LOCAL_BLOCK_BYTES ? threadCache(true) : nullptr;
+	if (cache) {
+		auto it = std::find_if(cache->blocks.begin(), cache->blocks.end(), [capacity](void* block) { return capacityOf(block) == capacity; });
+		if (it != cache->blocks.end()) {
+			data = *it;
+			cache->blocks.erase(it);
+		}
+	}
+	if (!data) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = freeBlocks.find(capacity);
+		if (it != freeBlocks.end() && !it->second.empty()) {
+			data = it->second.back();
+			it->second.pop_back();
+		}
+	}
+
+	if (data) {
+		hits++;
+		pooledBytes -= capacity;
+	}
+	else {
+		data = systemAlloc(capacity);
+	}
+	qint64 footprint = (usedBytes += capacity) + pooledBytes.load();
+	qint64 peak = peakBytes.load();
+	while (footprint > peak && !peakBytes.compare_exchange_weak(peak, footprint)) {}
+	return data;
+}
+
+void BufferPool::release(void* data)
+{
+	if (!data)
+		return;
+	std::size_t capacity = capacityOf(data);
+	usedBytes -= capacity;
+	if (pooledBytes.load() + static_cast<qint64>(capacity) > memoryLimit.load()) {
+		systemFree(data);
+		return;
+	}
+	pooledBytes += capacity;
+
+	LocalCache* cache = capacity <= LOCAL_BLOCK_BYTES ? threadCache(false) : nullptr;
+	if (!cache) {
+		pushFree(data);
+		return;
+	}
+	if (cache->blocks.size() >= LOCAL_BLOCKS) {
+		pushFree(cache->blocks.front());
+		cache->blocks.erase(cache->blocks.begin());
+	}
+	cache->blocks.push_back(data);
+}
+
+void BufferPool::pushFree(void* data)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	freeBlocks[capacityOf(data)].push_back(data);
+}
+
+void BufferPool::trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = freeBlocks.rbegin(); it != freeBlocks.rend() && pooledBytes.load() > memoryLimit.load(); ++it) {
+		while (!it->second.empty() && pooledBytes.load() > memoryLimit.load()) {
+			systemFree(it->second.back());
+			it->second.pop_back();
+			pooledBytes -= it->first;
+		}
+	}
+}
+
+void BufferPool::setMemoryLimit(qint64 bytes)
+{
+	memoryLimit = bytes;
+	trim();
+}
+
+void BufferPool::clear()
+{
+	if (LocalCache* cache = threadCache(false)) {
+		for (void* block : cache->blocks)
+			pushFree(block);
+		cache->blocks.clear();
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& entry : freeBlocks) {
+		for (void* block : entry.second) {
+			systemFree(block);
+			pooledBytes -= entry.first;
+		}
+	}
+	freeBlocks.clear();
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+	Stats s;
+	s.requests = requests.load();
+	s.hits = hits.load();
+	s.usedBytes = usedBytes.load();
+	s.pooledBytes = pooledBytes.load();
+	s.peakBytes = peakBytes.load();
+	return s;
+}
+
+// 
+
+static void releaseImage(void* data)
+{
+	BufferPool::instance().release(data);
+}
+
+static void copyMetadata(const QImage& src, QImage& dst)
+{
+	if (src.colorCount() > 0)
+		dst.setColorTable(src.colorTable());
+	dst.setDotsPerMeterX(src.dotsPerMeterX());
+	dst.setDotsPerMeterY(src.dotsPerMeterY());
+	dst.setOffset(src.offset());
+	dst.setDevicePixelRatio(src.devicePixelRatio());
+	for (const QString& key : src.textKeys())
+		dst.setText(key, src.text(key));
+}
+
+QImage BufferPool::image(int width, int height, QImage::Format format)
+{
+	if (width <= 0 || height <= 0 || format == QImage::Format_Invalid)
+		return QImage(width, height, format);
+	int depth = QImage::toPixelFormat(format).bitsPerPixel();
+	int bpl = static_cast<int>(((static_cast<qint64>(width) * depth + 31) >> 5) << 2);
+	auto data = static_cast<uchar*>(acquire(static_cast<std::size_t>(bpl) * height));
+	return QImage(data, width, height, bpl, format, releaseImage, data);
+}
+
+QImage BufferPool::like(const QImage& img)
+{
+	if (img.colorCount() > 0 || img.depth() % 8 != 0)
+		return copy(img);
+	QImage result = image(img.width(), img.height(), img.format());
+	if (!result.isNull())
+		copyMetadata(img, result);
+	return result;
+}
+
+QImage BufferPool::copy(const QImage& img, const QRect& rect)
+{
+	QRect area = rect.isNull() ? img.rect() : rect & img.rect();
+	if (img.depth() % 8 != 0 && area.x() != 0)
+		return img.copy(area);
+	QImage result = image(area.width(), area.height(), img.format());
+	if (result.isNull())
+		return img.copy(area);
+	copyMetadata(img, result);
+
+	std::size_t offset = static_cast<std::size_t>(area.x()) * img.depth() / 8;
+	std::size_t lineLen = (static_cast<std::size_t>(area.width()) * img.depth() + 7) / 8;
+	uchar* bits = result.bits();
+	int bpl = result.bytesPerLine();
+	for (int y = 0; y < area.height(); ++y)
+		std::memcpy(bits + static_cast<std::ptrdiff_t>(y) * bpl, img.constScanLine(area.y() + y) + offset, lineLen);
+	return result;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <QImage>
+#include <QRect>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+//  
+
+class BufferPool
+{
+public:
+	static const std::size_t ALIGNMENT = 64;
+	//        ,       
+	static const std::size_t LOCAL_BLOCKS = 4;
+	//   ()     : ,    ,    
+	static const std::size_t LOCAL_BLOCK_BYTES = 1 << 20;
+
+	struct Stats
+	{
+		qint64 requests = 0;
+		qint64 hits = 0;
+		qint64 usedBytes = 0;
+		qint64 pooledBytes = 0;
+		qint64 peakBytes = 0;
+	};
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+	static BufferPool& instance();
+
+	//    bytes ,   ALIGNMENT
+	void* acquire(std::size_t bytes);
+	void release(void* data);
+
+	//    :    ,    
+	QImage image(int width, int height, QImage::Format format);
+	//   ,   ,   img,   .
+	//    - ,   setPixelColor   
+	QImage like(const QImage& img);
+	//   img (   rect)
+	QImage copy(const QImage& img, const QRect& rect = QRect());
+
+	//     ;   
+	void setMemoryLimit(qint64 bytes);
+	void clear();
+	Stats stats() const;
+private:
+	struct LocalCache;
+	BufferPool() = default;
+	//     ,    
+	static LocalCache* threadCache(bool create);
+	void pushFree(void* data);
+	void trim();
+
+	std::map<std::size_t, std::vector<void*>> freeBlocks;
+	std::atomic<qint64> memoryLimit{ 256ll << 20 };
+	std::atomic<qint64> requests{ 0 };
+	std::atomic<qint64> hits{ 0 };
+	std::atomic<qint64> usedBytes{ 0 };
+	std::atomic<qint64> pooledBytes{ 0 };
+	std::atomic<qint64> peakBytes{ 0 };
+	mutable std::mutex mutex;
+};
+
+//        ;   
+template <class T>
+class PooledArray
+{
+	T* ptr;
+public:
+	explicit PooledArray(std::size_t count) : ptr(static_cast<T*>(BufferPool::instance().acquire(count * sizeof(T)))) {}
+	PooledArray(const PooledArray&) = delete;
+	PooledArray& operator=(const PooledArray&) = delete;
+	~PooledArray() { BufferPool::instance().release(ptr); }
+	T* data() { return ptr; }
+	const T* data() const { return ptr; }
+	T& operator[](std::size_t i) { return ptr[i]; }
+	const T& operator[](std::size_t i) const { return ptr[i]; }
+};
@@ -1,8 +1,19 @@
 #include "Filter.h"
+#include "ResultCache.h"
+#include "Metrics.h"
+#include "Parallel.h"
+#include "BufferPool.h"
+#include "LazyChain.h"
 #include <QImage>
+#include <QRegion>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <mutex>
+#include <typeinfo>
 
 template <class T>
 T clamp(T value, T max, T min)
@@ -14,11 +25,22 @@ T clamp(T value, T max, T min)
 	return value;
 }
 
+static qint64 pixelCount(const QImage& img)
+{
+	return static_cast<qint64>(img.width()) * img.height();
+}
+
+static bool isRgb32(const QImage& img)
+{
+	return img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32;
+}
+
 //  
 
-QImage Dilatation(const QImage& img, std::vector<std::vector<bool>> mask)
+static QImage DilatationImpl(const QImage& img, const std::vector<std::vector<bool>>& mask)
 {
-	QImage result(img);
+	QImage result = BufferPool::instance().copy(img);
+	METRICS_ALLOC(result.sizeInBytes());
 	int MH = mask.size();
 	int MW = mask.front().size();
 	auto cmp{ [](QColor A, QColor B) -> bool {
@@ -40,9 +62,10 @@ QImage Dilatation(const QImage& img, std::vector<std::vector<bool>> mask)
 	return result;
 }
 
-QImage Erosion(const QImage& img, std::vector<std::vector<bool>> mask)
+static QImage ErosionImpl(const QImage& img, const std::vector<std::vector<bool>>& mask)
 {
-	QImage result(img);
+	QImage result = BufferPool::instance().copy(img);
+	METRICS_ALLOC(result.sizeInBytes());
 	int MH = mask.size();
 	int MW = mask.front().size();
 	auto cmp{ [](QColor A, QColor B) -> bool {
@@ -64,18 +87,19 @@ QImage Erosion(const QImage& img, std::vector<std::vector<bool>> mask)
 	return result;
 }
 
-QImage Open(const QImage& img, std::vector<std::vector<bool>> mask) {
-	return Dilatation(Erosion(img, mask), mask);
+static QImage OpenImpl(const QImage& img, const std::vector<std::vector<bool>>& mask) {
+	return DilatationImpl(ErosionImpl(img, mask), mask);
 }
 
-QImage Close(const QImage& img, std::vector<std::vector<bool>> mask) {
-	return Erosion(Dilatation(img, mask), mask);
+static QImage CloseImpl(const QImage& img, const std::vector<std::vector<bool>>& mask) {
+	return ErosionImpl(DilatationImpl(img, mask), mask);
 }
 
-QImage Grad(const QImage& img, std::vector<std::vector<bool>> mask) {
-	auto Dilatated = Dilatation(img, mask);
-	auto Erosed = Erosion(img, mask);
-	QImage result(img);
+static QImage GradImpl(const QImage& img, const std::vector<std::vector<bool>>& mask) {
+	auto Dilatated = DilatationImpl(img, mask);
+	auto Erosed = ErosionImpl(img, mask);
+	QImage result = BufferPool::instance().like(img);
+	METRICS_ALLOC(result.sizeInBytes());
 	for (int j = 0; j < img.height(); ++j) {
 		for (int i = 0; i < img.width(); ++i) {
 			auto dpix = Dilatated.pixel(i, j);
@@ -90,11 +114,98 @@ QImage Grad(const QImage& img, std::vector<std::vector<bool>> mask) {
 	return result;
 }
 
+static void hashMask(Hasher& hasher, const std::vector<std::vector<bool>>& mask)
+{
+	hasher.add(mask.size());
+	for (const auto& row : mask) {
+		hasher.add(row.size());
+		for (bool value : row)
+			hasher.add(value);
+	}
+}
+
+// main      :      QImage::cacheKey()
+static quint64 imageKey(const QImage& img)
+{
+	static StatsMemo<quint64> memo;
+	quint64 key;
+	if (!memo.find(img, key)) {
+		key = Hasher().add(img).result();
+		memo.store(img, key);
+	}
+	return key;
+}
+
+static quint64 morphologyKey(const char* op, const QImage& img, const std::vector<std::vector<bool>>& mask)
+{
+	Hasher hasher(imageKey(img));
+	hasher.add(op);
+	hashMask(hasher, mask);
+	return hasher.result();
+}
+
+QImage Dilatation(const QImage& img, std::vector<std::vector<bool>> mask)
+{
+	METRICS_SCOPE("Dilatation", pixelCount(img));
+	return ResultCache::instance().lookup(morphologyKey("Dilatation", img, mask), [&] { return DilatationImpl(img, mask); });
+}
+
+QImage Erosion(const QImage& img, std::vector<std::vector<bool>> mask)
+{
+	METRICS_SCOPE("Erosion", pixelCount(img));
+	return ResultCache::instance().lookup(morphologyKey("Erosion", img, mask), [&] { return ErosionImpl(img, mask); });
+}
+
+QImage Open(const QImage& img, std::vector<std::vector<bool>> mask)
+{
+	METRICS_SCOPE("Open", pixelCount(img));
+	return ResultCache::instance().lookup(morphologyKey("Open", img, mask), [&] { return OpenImpl(img, mask); });
+}
+
+QImage Close(const QImage& img, std::vector<std::vector<bool>> mask)
+{
+	METRICS_SCOPE("Close", pixelCount(img));
+	return ResultCache::instance().lookup(morphologyKey("Close", img, mask), [&] { return CloseImpl(img, mask); });
+}
+
+QImage Grad(const QImage& img, std::vector<std::vector<bool>> mask)
+{
+	METRICS_SCOPE("Grad", pixelCount(img));
+	return ResultCache::instance().lookup(morphologyKey("Grad", img, mask), [&] { return GradImpl(img, mask); });
+}
+
 //     Filter
 
 QImage Filter::process(const QImage& img) const
 {
-	QImage result(img);
+	METRICS_SCOPE(ScopedTimer::typeName(typeid(*this).name()), pixelCount(img));
+	if (!isCacheable())
+		return compute(img);
+	return ResultCache::instance().lookup(cacheKey(imageKey(img)), [&] { return compute(img); });
+}
+
+QImage Filter::compute(const QImage& img) const
+{
+	QImage result = processImage(img);
+	METRICS_ALLOC(result.sizeInBytes());
+	return result;
+}
+
+quint64 Filter::cacheKey(quint64 inputKey) const
+{
+	Hasher hasher(inputKey);
+	hashParams(hasher);
+	return hasher.result();
+}
+
+void Filter::hashParams(Hasher& hasher) const
+{
+	hasher.add(typeid(*this).name());
+}
+
+QImage Filter::processImage(const QImage& img) const
+{
+	QImage result = BufferPool::instance().like(img);
 
 	for (int x = 0; x < img.width(); ++x) {
 		for (int y = 0; y < img.height(); ++y) {
@@ -105,14 +216,69 @@ QImage Filter::process(const QImage& img) const
 	return result;
 }
 
+static void copyRect(const QImage& src, QImage& dst, const QRect& rect, const QPoint& pos)
+{
+	if (src.depth() % 8 != 0) {
+		for (int y = 0; y < rect.height(); ++y)
+			for (int x = 0; x < rect.width(); ++x)
+				dst.setPixelColor(pos.x() + x, pos.y() + y, src.pixelColor(rect.x() + x, rect.y() + y));
+		return;
+	}
+	int bpp = src.depth() / 8;
+	for (int y = 0; y < rect.height(); ++y) {
+		std::memcpy(dst.scanLine(pos.y() + y) + pos.x() * bpp, src.constScanLine(rect.y() + y) + rect.x() * bpp, rect.width() * bpp);
+	}
+}
+
+static bool sameGeometry(const QImage& img, const QImage& prevImg, const QImage& prevResult)
+{
+	return img.size() == prevImg.size() && img.size() == prevResult.size() && img.format() == prevResult.format();
+}
+
+//  ,      ,  -    
+static QImage writable(QImage&& prevResult)
+{
+	if (prevResult.isDetached())
+		return std::move(prevResult);
+	return BufferPool::instance().copy(prevResult);
+}
+
+QImage Filter::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
+{
+	if (!sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+	int radius = getRadius();
+	QRegion region;
+	for (const auto& rect : dirty)
+		region += rect.adjusted(-radius, -radius, radius, radius) & img.rect();
+
+	qint64 pixels = 0;
+	for (const auto& rect : region)
+		pixels += static_cast<qint64>(rect.width()) * rect.height();
+	METRICS_SCOPE(ScopedTimer::typeName(typeid(*this).name()), pixels);
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		QRect src = rect.adjusted(-radius, -radius, radius, radius) & img.rect();
+		QImage part = compute(BufferPool::instance().copy(img, src));
+		copyRect(part, result, rect.translated(-src.topLeft()), rect.topLeft());
+		dirty.push_back(rect);
+	}
+	return result;
+}
+
 //  process
 
-QImage SobelFilter::process(const QImage& img) const
+QImage SobelFilter::processImage(const QImage& img) const
 {
-	auto result = GrayScaleFilter().process(img);
+	auto gray = compute(GrayScaleFilter(), img);
 
-	auto X = SobelXFilter().process(result);
-	auto Y = SobelYFilter().process(result);
+	auto X = compute(SobelXFilter(), gray);
+	auto Y = compute(SobelYFilter(), gray);
+	QImage result = BufferPool::instance().like(gray);
 	for (int x = 0; x < img.width(); ++x) {
 		for (int y = 0; y < img.height(); ++y) {
 			auto colorX = qGreen(X.pixel(x, y));
@@ -124,12 +290,13 @@ QImage SobelFilter::process(const QImage& img) const
 	return result;
 }
 
-QImage PrewittFilter::process(const QImage& img) const
+QImage PrewittFilter::processImage(const QImage& img) const
 {
-	auto result = GrayScaleFilter().process(img);
+	auto gray = compute(GrayScaleFilter(), img);
 
-	auto X = PrewittXFilter().process(result);
-	auto Y = PrewittYFilter().process(result);
+	auto X = compute(PrewittXFilter(), gray);
+	auto Y = compute(PrewittYFilter(), gray);
+	QImage result = BufferPool::instance().like(gray);
 	for (int x = 0; x < img.width(); ++x) {
 		for (int y = 0; y < img.height(); ++y) {
 			auto colorX = qGreen(X.pixel(x, y));
@@ -141,28 +308,303 @@ QImage PrewittFilter::process(const QImage& img) const
 	return result;
 }
 
-QImage GrayWorld::process(const QImage& img) const
+// 
+
+static int findRoot(PooledArray<int>& parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+//    -       
+static int rootOf(const PooledArray<int>& parent, int i)
+{
+	while (parent[i] != i)
+		i = parent[i];
+	return i;
+}
+
+static void unite(PooledArray<int>& parent, PooledArray<uchar>& strong, int a, int b)
+{
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if (a == b)
+		return;
+	if (a > b)
+		std::swap(a, b);
+	parent[b] = a;
+	strong[a] |= strong[b];
+}
+
+QImage CannyFilter::detect(const QImage& img, std::vector<std::vector<QPoint>>* edges) const
+{
+	if (edges)
+		edges->clear();
+	GrayScaleFilter gray;
+	GaussianFilter gauss(radius, sigma);
+	QImage smooth = (LazyChain(img) | gray | gauss).eval();
+	int w = smooth.width();
+	int h = smooth.height();
+	std::size_t pixels = static_cast<std::size_t>(w) * h;
+	QImage result = BufferPool::instance().image(w, h, QImage::Format_RGB32);
+	METRICS_ALLOC(result.sizeInBytes());
+	if (pixels == 0)
+		return result;
+
+	//       y,  SobelKernel_X    y
+	SobelKernel_Y kernelX;
+	SobelKernel_X kernelY;
+	PooledArray<short> gx(pixels), gy(pixels);
+	PooledArray<float> magnitude(pixels);
+	parallelFor(0, h, [&](int first, int last) {
+		for (int y = first; y < last; ++y) {
+			const QRgb* rows[3];
+			for (int i = 0; i < 3; ++i)
+				rows[i] = reinterpret_cast<const QRgb*>(smooth.constScanLine(clamp(y + i - 1, h - 1, 0)));
+			for (int x = 0; x < w; ++x) {
+				int sumX = 0;
+				int sumY = 0;
+				for (int i = 0; i < 3; ++i) {
+					for (int j = 0; j < 3; ++j) {
+						int value = qGreen(rows[i][clamp(x + j - 1, w - 1, 0)]);
+						sumX += value * static_cast<int>(kernelX[i * 3 + j]);
+						sumY += value * static_cast<int>(kernelY[i * 3 + j]);
+					}
+				}
+				std::size_t idx = static_cast<std::size_t>(y) * w + x;
+				gx[idx] = static_cast<short>(sumX);
+				gy[idx] = static_cast<short>(sumY);
+				magnitude[idx] = std::sqrt(static_cast<float>(sumX * sumX + sumY * sumY));
+			}
+		}
+	}, 16);
+
+	//    : 0 -  , 1 - , 2 - 
+	const int TILE = 64;
+	int tilesX = (w + TILE - 1) / TILE;
+	int tilesY = (h + TILE - 1) / TILE;
+	PooledArray<uchar> state(pixels);
+	std::fill(state.data(), state.data() + pixels, 0);
+	parallelFor(0, tilesX * tilesY, [&](int first, int last) {
+		for (int tile = first; tile < last; ++tile) {
+			int x0 = tile % tilesX * TILE;
+			int y0 = tile / tilesX * TILE;
+			for (int y = std::max(y0, 1); y < std::min(y0 + TILE, h - 1); ++y) {
+				for (int x = std::max(x0, 1); x < std::min(x0 + TILE, w - 1); ++x) {
+					int idx = y * w + x;
+					float m = magnitude[idx];
+					if (m < low)
+						continue;
+					float ax = std::abs(static_cast<float>(gx[idx]));
+					float ay = std::abs(static_cast<float>(gy[idx]));
+					int step;
+					if (ay <= ax * 0.4142f)
+						step = 1;
+					else if (ay >= ax * 2.4142f)
+						step = w;
+					else
+						step = (gx[idx] < 0) == (gy[idx] < 0) ? w + 1 : w - 1;
+					if (m > magnitude[idx - step] && m >= magnitude[idx + step])
+						state[idx] = m >= high ? 2 : 1;
+				}
+			}
+		}
+	});
+
+	// :      ,   .
+	//         
+	PooledArray<int> parent(pixels);
+	PooledArray<uchar> strong(pixels);
+	int bands = std::min(threadCount(), h);
+	auto bandStart = [&](int band) { return static_cast<int>(static_cast<long long>(h) * band / bands); };
+	auto linkAbove = [&](int x, int y) {
+		int idx = y * w + x;
+		for (int dx = -1; dx <= 1; ++dx) {
+			if (x + dx >= 0 && x + dx < w && state[idx - w + dx])
+				unite(parent, strong, idx, idx - w + dx);
+		}
+	};
+	parallelFor(0, bands, [&](int first, int last) {
+		for (int band = first; band < last; ++band) {
+			for (int y = bandStart(band); y < bandStart(band + 1); ++y) {
+				for (int x = 0; x < w; ++x) {
+					int idx = y * w + x;
+					parent[idx] = idx;
+					strong[idx] = state[idx] == 2;
+					if (!state[idx])
+						continue;
+					if (x > 0 && state[idx - 1])
+						unite(parent, strong, idx, idx - 1);
+					if (y > bandStart(band))
+						linkAbove(x, y);
+				}
+			}
+		}
+	});
+	for (int band = 1; band < bands; ++band) {
+		int y = bandStart(band);
+		for (int x = 0; x < w; ++x) {
+			if (state[y * w + x])
+				linkAbove(x, y);
+		}
+	}
+
+	uchar* bits = result.bits();
+	int bpl = result.bytesPerLine();
+	parallelFor(0, h, [&](int first, int last) {
+		for (int y = first; y < last; ++y) {
+			auto dst = reinterpret_cast<QRgb*>(bits + static_cast<std::ptrdiff_t>(y) * bpl);
+			for (int x = 0; x < w; ++x) {
+				int idx = y * w + x;
+				dst[x] = state[idx] && strong[rootOf(parent, idx)] ? qRgb(255, 255, 255) : qRgb(0, 0, 0);
+			}
+		}
+	}, 16);
+
+	if (edges) {
+		PooledArray<int> list(pixels);
+		std::fill(list.data(), list.data() + pixels, -1);
+		for (int y = 0; y < h; ++y) {
+			for (int x = 0; x < w; ++x) {
+				int idx = y * w + x;
+				if (!state[idx])
+					continue;
+				int root = rootOf(parent, idx);
+				if (!strong[root])
+					continue;
+				if (list[root] < 0) {
+					list[root] = static_cast<int>(edges->size());
+					edges->emplace_back();
+				}
+				(*edges)[list[root]].emplace_back(x, y);
+			}
+		}
+	}
+	return result;
+}
+
+QImage CannyFilter::processImage(const QImage& img) const
+{
+	return detect(img);
+}
+
+QImage CannyFilter::processDirty(const QImage& img, const QImage&, QImage, std::vector<QRect>& dirty) const
+{
+	//      ,   
+	dirty = { img.rect() };
+	return process(img);
+}
+
+void CannyFilter::hashParams(Hasher& hasher) const
+{
+	Filter::hashParams(hasher);
+	hasher.add(low);
+	hasher.add(high);
+	hasher.add(radius);
+	hasher.add(sigma);
+}
+
+static ChannelSums channelSums(const QImage& img, const QRect& rect)
+{
+	ChannelSums sums = {};
+	bool fast = isRgb32(img);
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		auto row = reinterpret_cast<const QRgb*>(img.constScanLine(y));
+		for (int x = rect.left(); x <= rect.right(); ++x) {
+			QRgb pix = fast ? row[x] : img.pixel(x, y);
+			sums[0] += qRed(pix);
+			sums[1] += qGreen(pix);
+			sums[2] += qBlue(pix);
+		}
+	}
+	return sums;
+}
+
+static ChannelSums channelSums(const QImage& img)
+{
+	ChannelSums sums = {};
+	std::mutex mutex;
+	parallelFor(0, img.height(), [&](int first, int last) {
+		ChannelSums local = channelSums(img, QRect(0, first, img.width(), last - first));
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int c = 0; c < 3; ++c)
+			sums[c] += local[c];
+	}, 64);
+	return sums;
+}
+
+QImage GrayWorld::processImage(const QImage& img) const
 {
-	QImage result(img);
+	ChannelSums total = channelSums(img);
+	sums.store(img, total);
+	float N = static_cast<float>(pixelCount(img));
+	QImage result = BufferPool::instance().like(img);
+	processRect(img, result, img.rect(), total[0] / N, total[1] / N, total[2] / N);
+	return result;
+}
 
-	float R = RedAvg(img);
-	float G = GreenAvg(img);
-	float B = BlueAvg(img);
+void GrayWorld::processRect(const QImage& img, QImage& result, const QRect& rect, float R, float G, float B) const
+{
 	float Avg = (R + G + B) / 3;
 
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
+	for (int x = rect.left(); x <= rect.right(); ++x) {
+		for (int y = rect.top(); y <= rect.bottom(); ++y) {
 			QColor color = calcNewPixelColor(img, x, y);
 			color.setRgb(clamp(color.red() * Avg / R, 255.f, 0.f), clamp(color.green() * Avg / G, 255.f, 0.f), clamp(color.blue() * Avg / B, 255.f, 0.f));
 			result.setPixelColor(x, y, color);
 		}
 	}
+}
+
+QImage GrayWorld::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
+{
+	if (!sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+	ChannelSums prev;
+	if (!sums.find(prevImg, prev))
+		prev = channelSums(prevImg);
+
+	//       
+	QRegion region;
+	for (const auto& rect : dirty)
+		region += rect & img.rect();
+	ChannelSums total = prev;
+	for (const auto& rect : region) {
+		ChannelSums before = channelSums(prevImg, rect);
+		ChannelSums after = channelSums(img, rect);
+		for (int c = 0; c < 3; ++c)
+			total[c] += after[c] - before[c];
+	}
+	sums.store(img, total);
+
+	float N = static_cast<float>(pixelCount(img));
+	float R = total[0] / N;
+	float G = total[1] / N;
+	float B = total[2] / N;
+	if (total != prev) {
+		QImage result = BufferPool::instance().like(img);
+		processRect(img, result, img.rect(), R, G, B);
+		dirty = { img.rect() };
+		return result;
+	}
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		processRect(img, result, rect, R, G, B);
+		dirty.push_back(rect);
+	}
 	return result;
 }
 
-QImage BaseColor::process(const QImage& img) const
+QImage BaseColor::processImage(const QImage& img) const
 {
-	QImage result(img);
+	QImage result = BufferPool::instance().like(img);
 	float R, G, B;
 	int x_src, y_src;
 	std::cout << "Enter pixel coord" << std::endl;
@@ -180,97 +622,476 @@ QImage BaseColor::process(const QImage& img) const
 	return result;
 }
 
-QImage Shift::process(const QImage& img) const
+QImage BaseColor::processDirty(const QImage& img, const QImage&, QImage, std::vector<QRect>& dirty) const
 {
-	QImage result(img);
+	dirty = { img.rect() };
+	return process(img);
+}
 
-	for (int x = 0; x < img.width() - 50; ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			QColor color = calcNewPixelColor(img, x + 50, y);
-			result.setPixelColor(x, y, color);
-		}
-	}
-	for (int x = img.width() - 50; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
+QImage Shift::processImage(const QImage& img) const
+{
+	QImage result = BufferPool::instance().like(img);
+	processRect(img, result, img.rect());
+	return result;
+}
+
+void Shift::processRect(const QImage& img, QImage& result, const QRect& rect) const
+{
+	for (int x = rect.left(); x <= rect.right(); ++x) {
+		for (int y = rect.top(); y <= rect.bottom(); ++y) {
 			QColor color;
-			color.setRgb(0, 0, 0);
+			if (x < img.width() - offset)
+				color = calcNewPixelColor(img, x + offset, y);
+			else
+				color.setRgb(0, 0, 0);
 			result.setPixelColor(x, y, color);
 		}
 	}
+}
+
+QImage Shift::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
+{
+	if (!sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+	QRegion region;
+	for (const auto& rect : dirty)
+		region += rect.translated(-offset, 0) & QRect(0, 0, img.width() - offset, img.height());
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		processRect(img, result, rect);
+		dirty.push_back(rect);
+	}
 	return result;
 }
 
-QImage HistFilter::process(const QImage& img) const
+// 
+
+static void valueHistogram(const QImage& img, const QRect& rect, quint32* hist)
 {
-	QImage result(img);
-	int v_max = 0, v_min = 255;
+	std::fill(hist, hist + 256, 0u);
+	if (img.format() == QImage::Format_Grayscale8) {
+		for (int y = rect.top(); y <= rect.bottom(); ++y) {
+			const uchar* row = img.constScanLine(y);
+			for (int x = rect.left(); x <= rect.right(); ++x)
+				hist[row[x]]++;
+		}
+		return;
+	}
+	bool fast = isRgb32(img);
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		auto row = reinterpret_cast<const QRgb*>(img.constScanLine(y));
+		for (int x = rect.left(); x <= rect.right(); ++x) {
+			QRgb pix = fast ? row[x] : img.pixel(x, y);
+			hist[std::max({ qRed(pix), qGreen(pix), qBlue(pix) })]++;
+		}
+	}
+}
 
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			auto pix = img.pixel(x, y);
-			auto v = std::max({ qRed(pix), qBlue(pix), qGreen(pix) });
-			v_max = std::max(v, v_max);
+static void valueHistogram(const QImage& img, quint32* hist)
+{
+	std::fill(hist, hist + 256, 0u);
+	std::mutex mutex;
+	parallelFor(0, img.height(), [&](int first, int last) {
+		quint32 local[256];
+		valueHistogram(img, QRect(0, first, img.width(), last - first), local);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int v = 0; v < 256; ++v)
+			hist[v] += local[v];
+	}, 64);
+}
+
+static void histogramRange(const quint32* hist, int& v_min, int& v_max)
+{
+	v_max = 0;
+	v_min = 255;
+	for (int v = 0; v < 256; ++v) {
+		if (hist[v]) {
 			v_min = std::min(v, v_min);
+			v_max = v;
 		}
 	}
-	auto stretch{ [v_max, v_min](int value) -> int {
-			return ((value - v_min) * 255) / (v_max - v_min);
-	} };
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			auto pix = img.pixel(x, y);
-			result.setPixelColor(x, y, { stretch(qRed(pix)), stretch(qGreen(pix)), stretch(qBlue(pix)) });
+}
+
+//   prevImg  img,    region
+static void updateHistogram(quint32* hist, const QImage& img, const QImage& prevImg, const QRegion& region)
+{
+	quint32 part[256];
+	for (const auto& rect : region) {
+		valueHistogram(prevImg, rect, part);
+		for (int v = 0; v < 256; ++v)
+			hist[v] -= part[v];
+		valueHistogram(img, rect, part);
+		for (int v = 0; v < 256; ++v)
+			hist[v] += part[v];
+	}
+}
+
+// lut    ,  rect  
+static void applyLut(const QImage& img, QImage& result, const QRect& rect, const uchar* lut)
+{
+	bool gray = img.format() == QImage::Format_Grayscale8;
+	if (!(gray || isRgb32(img)) || result.format() != img.format()) {
+		for (int y = rect.top(); y <= rect.bottom(); ++y) {
+			for (int x = rect.left(); x <= rect.right(); ++x) {
+				QRgb pix = img.pixel(x, y);
+				result.setPixelColor(x, y, { lut[qRed(pix)], lut[qGreen(pix)], lut[qBlue(pix)] });
+			}
 		}
+		return;
 	}
+	uchar* bits = result.bits();
+	int bpl = result.bytesPerLine();
+	parallelFor(rect.top(), rect.bottom() + 1, [&](int first, int last) {
+		for (int y = first; y < last; ++y) {
+			uchar* line = bits + static_cast<std::ptrdiff_t>(y) * bpl;
+			if (gray) {
+				const uchar* src = img.constScanLine(y);
+				for (int x = rect.left(); x <= rect.right(); ++x)
+					line[x] = lut[src[x]];
+				continue;
+			}
+			auto src = reinterpret_cast<const QRgb*>(img.constScanLine(y));
+			auto dst = reinterpret_cast<QRgb*>(line);
+			for (int x = rect.left(); x <= rect.right(); ++x)
+				dst[x] = qRgb(lut[qRed(src[x])], lut[qGreen(src[x])], lut[qBlue(src[x])]);
+		}
+	}, 16);
+}
 
+QImage HistFilter::processImage(const QImage& img) const
+{
+	ValueHistogram hist;
+	valueHistogram(img, hist.data());
+	histogram.store(img, hist);
+	int v_max, v_min;
+	histogramRange(hist.data(), v_min, v_max);
+	QImage result = BufferPool::instance().like(img);
+	processRect(img, result, img.rect(), v_min, v_max);
 	return result;
 }
 
-//   GrayWorld
+void HistFilter::processRect(const QImage& img, QImage& result, const QRect& rect, int v_min, int v_max) const
+{
+	//     -   
+	uchar lut[256];
+	for (int value = 0; value < 256; ++value)
+		lut[value] = static_cast<uchar>(v_max > v_min ? clamp((value - v_min) * 255 / (v_max - v_min), 255, 0) : value);
+	applyLut(img, result, rect, lut);
+}
 
-float Filter::RedAvg(const QImage& img) const
+QImage HistFilter::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
 {
-	float result = 0;
-	int N = 0;
+	if (!sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+	ValueHistogram hist;
+	if (!histogram.find(prevImg, hist))
+		valueHistogram(prevImg, hist.data());
+	int v_max, v_min, prev_max, prev_min;
+	histogramRange(hist.data(), prev_min, prev_max);
 
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			QColor color = img.pixelColor(x, y);
-			result += color.red();
-			N++;
-		}
+	QRegion region;
+	for (const auto& rect : dirty)
+		region += rect & img.rect();
+	updateHistogram(hist.data(), img, prevImg, region);
+	histogram.store(img, hist);
+	histogramRange(hist.data(), v_min, v_max);
+	if (v_min != prev_min || v_max != prev_max) {
+		QImage result = BufferPool::instance().like(img);
+		processRect(img, result, img.rect(), v_min, v_max);
+		dirty = { img.rect() };
+		return result;
 	}
-	return result / N;
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		processRect(img, result, rect, v_min, v_max);
+		dirty.push_back(rect);
+	}
+	return result;
 }
 
-float Filter::GreenAvg(const QImage& img) const
+static void equalizationLut(const quint32* hist, uchar* lut)
+{
+	quint64 total = 0;
+	quint64 cdf_min = 0;
+	for (int v = 0; v < 256; ++v) {
+		if (!cdf_min)
+			cdf_min = hist[v];
+		total += hist[v];
+	}
+	quint64 cdf = 0;
+	for (int v = 0; v < 256; ++v) {
+		cdf += hist[v];
+		if (total == cdf_min)
+			lut[v] = static_cast<uchar>(v);
+		else
+			lut[v] = static_cast<uchar>(cdf < cdf_min ? 0 : ((cdf - cdf_min) * 255 + (total - cdf_min) / 2) / (total - cdf_min));
+	}
+}
+
+QImage HistEqualizationFilter::processImage(const QImage& img) const
 {
-	float result = 0;
-	int N = 0;
+	ValueHistogram hist;
+	uchar lut[256];
+	valueHistogram(img, hist.data());
+	histogram.store(img, hist);
+	equalizationLut(hist.data(), lut);
+	QImage result = BufferPool::instance().like(img);
+	applyLut(img, result, img.rect(), lut);
+	return result;
+}
 
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			QColor color = img.pixelColor(x, y);
-			result += color.green();
-			N++;
+QImage HistEqualizationFilter::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
+{
+	if (!sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+	ValueHistogram hist;
+	if (!histogram.find(prevImg, hist))
+		valueHistogram(prevImg, hist.data());
+	uchar lut[256], prevLut[256];
+	equalizationLut(hist.data(), prevLut);
+
+	QRegion region;
+	for (const auto& rect : dirty)
+		region += rect & img.rect();
+	updateHistogram(hist.data(), img, prevImg, region);
+	histogram.store(img, hist);
+	equalizationLut(hist.data(), lut);
+	//        
+	if (!std::equal(lut, lut + 256, prevLut)) {
+		QImage result = BufferPool::instance().like(img);
+		applyLut(img, result, img.rect(), lut);
+		dirty = { img.rect() };
+		return result;
+	}
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		applyLut(img, result, rect, lut);
+		dirty.push_back(rect);
+	}
+	return result;
+}
+
+// CLAHE
+
+ClaheFilter::Grid ClaheFilter::makeGrid(const QImage& img) const
+{
+	Grid grid;
+	int countX = std::max(1, std::min(tilesX, img.width()));
+	int countY = std::max(1, std::min(tilesY, img.height()));
+	grid.tileW = std::max(1, (img.width() + countX - 1) / countX);
+	grid.tileH = std::max(1, (img.height() + countY - 1) / countY);
+	grid.countX = (img.width() + grid.tileW - 1) / grid.tileW;
+	grid.countY = (img.height() + grid.tileH - 1) / grid.tileH;
+	return grid;
+}
+
+void ClaheFilter::tileLut(const QImage& img, const Grid& grid, int tile, uchar* lut) const
+{
+	quint32 hist[256];
+	QRect rect = QRect(tile % grid.countX * grid.tileW, tile / grid.countX * grid.tileH, grid.tileW, grid.tileH) & img.rect();
+	valueHistogram(img, rect, hist);
+	quint64 pixels = static_cast<quint64>(rect.width()) * rect.height();
+
+	//          
+	if (clipLimit > 0) {
+		quint32 limit = std::max<quint32>(1, static_cast<quint32>(clipLimit * pixels / 256));
+		quint32 excess = 0;
+		for (auto& count : hist) {
+			if (count > limit) {
+				excess += count - limit;
+				count = limit;
+			}
+		}
+		for (auto& count : hist)
+			count += excess / 256;
+		//    ,           
+		quint32 residual = excess % 256;
+		if (residual) {
+			quint32 step = std::max<quint32>(256 / residual, 1);
+			for (quint32 v = 0; v < 256 && residual; v += step, --residual)
+				hist[v]++;
 		}
 	}
-	return result / N;
+
+	quint64 cdf = 0;
+	for (int v = 0; v < 256; ++v) {
+		cdf += hist[v];
+		lut[v] = static_cast<uchar>(std::min<quint64>(255, cdf * 255 / pixels));
+	}
 }
 
-float Filter::BlueAvg(const QImage& img) const
+std::vector<uchar> ClaheFilter::tileLuts(const QImage& img, const Grid& grid) const
 {
-	float result = 0;
-	int N = 0;
+	std::vector<uchar> luts(static_cast<std::size_t>(grid.countX) * grid.countY * 256);
+	parallelFor(0, grid.countX * grid.countY, [&](int first, int last) {
+		for (int tile = first; tile < last; ++tile)
+			tileLut(img, grid, tile, &luts[static_cast<std::size_t>(tile) * 256]);
+	});
+	return luts;
+}
 
-	for (int x = 0; x < img.width(); ++x) {
-		for (int y = 0; y < img.height(); ++y) {
-			QColor color = img.pixelColor(x, y);
-			result += color.blue();
-			N++;
+//        pos       1/256
+static void tileNeighbours(int pos, int size, int count, int& first, int& second, int& weight)
+{
+	float t = (pos + 0.5f) / size - 0.5f;
+	first = clamp(static_cast<int>(std::floor(t)), count - 1, 0);
+	second = std::min(first + 1, count - 1);
+	weight = clamp(static_cast<int>((t - first) * 256 + 0.5f), 256, 0);
+}
+
+void ClaheFilter::processRect(const QImage& img, QImage& result, const QRect& rect, const Grid& grid, const std::vector<uchar>& luts) const
+{
+	std::vector<int> left(rect.width()), right(rect.width()), weightX(rect.width());
+	for (int i = 0; i < rect.width(); ++i)
+		tileNeighbours(rect.left() + i, grid.tileW, grid.countX, left[i], right[i], weightX[i]);
+
+	bool gray = img.format() == QImage::Format_Grayscale8;
+	uchar* bits = result.bits();
+	int bpl = result.bytesPerLine();
+	parallelFor(rect.top(), rect.bottom() + 1, [&](int first, int last) {
+		for (int y = first; y < last; ++y) {
+			int top, bottom, wy;
+			tileNeighbours(y, grid.tileH, grid.countY, top, bottom, wy);
+			const uchar* topRow = &luts[static_cast<std::size_t>(top) * grid.countX * 256];
+			const uchar* bottomRow = &luts[static_cast<std::size_t>(bottom) * grid.countX * 256];
+			const uchar* src = img.constScanLine(y);
+			uchar* dst = bits + static_cast<std::ptrdiff_t>(y) * bpl;
+			for (int i = 0; i < rect.width(); ++i) {
+				const uchar* a = topRow + left[i] * 256;
+				const uchar* b = topRow + right[i] * 256;
+				const uchar* c = bottomRow + left[i] * 256;
+				const uchar* d = bottomRow + right[i] * 256;
+				int wx = weightX[i];
+				auto blend = [&](int v) {
+					int upper = a[v] * (256 - wx) + b[v] * wx;
+					int lower = c[v] * (256 - wx) + d[v] * wx;
+					return (upper * (256 - wy) + lower * wy + 32768) >> 16;
+				};
+				int x = rect.left() + i;
+				if (gray) {
+					dst[x] = static_cast<uchar>(blend(src[x]));
+					continue;
+				}
+				QRgb pix = reinterpret_cast<const QRgb*>(src)[x];
+				reinterpret_cast<QRgb*>(dst)[x] = qRgb(blend(qRed(pix)), blend(qGreen(pix)), blend(qBlue(pix)));
+			}
 		}
+	}, 16);
+}
+
+static bool claheFormat(const QImage& img)
+{
+	return isRgb32(img) || img.format() == QImage::Format_Grayscale8;
+}
+
+QImage ClaheFilter::processImage(const QImage& img) const
+{
+	if (img.isNull() || img.width() == 0 || img.height() == 0)
+		return img;
+	//     ARGB32     
+	bool native = claheFormat(img);
+	QImage src(native ? img : img.convertToFormat(QImage::Format_ARGB32));
+	Grid grid = makeGrid(src);
+	std::vector<uchar> luts = tileLuts(src, grid);
+	if (native)
+		tables.store(img, luts);
+	QImage result = BufferPool::instance().like(src);
+	processRect(src, result, src.rect(), grid, luts);
+	return native ? result : result.convertToFormat(img.format());
+}
+
+QImage ClaheFilter::processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const
+{
+	if (!claheFormat(img) || !sameGeometry(img, prevImg, prevResult)) {
+		dirty = { img.rect() };
+		return process(img);
+	}
+
+	Grid grid = makeGrid(img);
+	std::vector<uchar> luts;
+	if (!tables.find(prevImg, luts))
+		luts = tileLuts(prevImg, grid);
+
+	//     
+	QRegion region;
+	std::vector<bool> touched(static_cast<std::size_t>(grid.countX) * grid.countY);
+	for (const auto& rect : dirty) {
+		QRect clipped = rect & img.rect();
+		if (clipped.isEmpty())
+			continue;
+		region += clipped;
+		for (int ty = clipped.top() / grid.tileH; ty <= clipped.bottom() / grid.tileH; ++ty)
+			for (int tx = clipped.left() / grid.tileW; tx <= clipped.right() / grid.tileW; ++tx)
+				touched[static_cast<std::size_t>(ty) * grid.countX + tx] = true;
+	}
+	std::vector<int> tiles;
+	for (int tile = 0; tile < grid.countX * grid.countY; ++tile)
+		if (touched[tile])
+			tiles.push_back(tile);
+	std::vector<uchar> changed(tiles.size());
+	parallelFor(0, static_cast<int>(tiles.size()), [&](int first, int last) {
+		uchar lut[256];
+		for (int i = first; i < last; ++i) {
+			uchar* old = &luts[static_cast<std::size_t>(tiles[i]) * 256];
+			tileLut(img, grid, tiles[i], lut);
+			changed[i] = !std::equal(lut, lut + 256, old);
+			std::copy(lut, lut + 256, old);
+		}
+	});
+	tables.store(img, luts);
+
+	//       
+	for (std::size_t i = 0; i < tiles.size(); ++i) {
+		if (!changed[i])
+			continue;
+		int tx = tiles[i] % grid.countX, ty = tiles[i] / grid.countX;
+		region += QRect((tx - 1) * grid.tileW, (ty - 1) * grid.tileH, 3 * grid.tileW, 3 * grid.tileH) & img.rect();
+	}
+
+	QImage result = writable(std::move(prevResult));
+	dirty.clear();
+	for (const auto& rect : region) {
+		processRect(img, result, rect, grid, luts);
+		dirty.push_back(rect);
 	}
-	return result / N;
+	return result;
+}
+
+void ClaheFilter::hashParams(Hasher& hasher) const
+{
+	Filter::hashParams(hasher);
+	hasher.add(tilesX);
+	hasher.add(tilesY);
+	hasher.add(clipLimit);
+}
+
+//   GrayWorld
+
+float Filter::RedAvg(const QImage& img) const
+{
+	return channelSums(img)[0] / static_cast<float>(pixelCount(img));
+}
+
+float Filter::GreenAvg(const QImage& img) const
+{
+	return channelSums(img)[1] / static_cast<float>(pixelCount(img));
+}
+
+float Filter::BlueAvg(const QImage& img) const
+{
+	return channelSums(img)[2] / static_cast<float>(pixelCount(img));
 }
 
 //  calcNewPixelColor   
@@ -289,24 +1110,35 @@ QColor BaseColor::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
-QColor InvertFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+QColor PointFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
-	QColor color = img.pixelColor(x, y);
+	return calcNewColor(img.pixelColor(x, y));
+}
+
+void PointFilter::processRow(QRgb* row, int width) const
+{
+	for (int x = 0; x < width; ++x)
+		row[x] = calcNewColor(QColor::fromRgba(row[x])).rgba();
+}
+
+QColor InvertFilter::calcNewColor(const QColor& src) const
+{
+	QColor color = src;
 	color.setRgb(255 - color.red(), 255 - color.green(), 255 - color.blue());
 	return color;
 }
 
-QColor GrayScaleFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+QColor GrayScaleFilter::calcNewColor(const QColor& src) const
 {
-	QColor color = img.pixelColor(x, y);
+	QColor color = src;
 	float Intensity = 0.299 * color.red() + 0.587 * color.green() + 0.113 * color.blue();
 	color.setRgb((int)Intensity, (int)Intensity, (int)Intensity);
 	return color;
 }
 
-QColor Sepia::calcNewPixelColor(const QImage& img, int x, int y) const
+QColor Sepia::calcNewColor(const QColor& src) const
 {
-	QColor color = img.pixelColor(x, y);
+	QColor color = src;
 	const int k = 15;
 	float Intensity = 0.299 * color.red() + 0.587 * color.green() + 0.113 * color.blue();
 	float returnR = Intensity + 2 * k;
@@ -316,9 +1148,9 @@ QColor Sepia::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
-QColor Brightness::calcNewPixelColor(const QImage& img, int x, int y) const
+QColor Brightness::calcNewColor(const QColor& src) const
 {
-	QColor color = img.pixelColor(x, y);
+	QColor color = src;
 	const int k = 50;
 	float returnR = color.red() + k;
 	float returnG = color.green() + k;
@@ -395,7 +1227,173 @@ QColor MatrixFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 	return QColor(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
 }
 
+void MatrixFilter::processRow(const QRgb* const* rows, QRgb* result, int width) const
+{
+	int size = mKernel.getSize();
+	int radius = mKernel.getRadius();
+	for (int x = 0; x < width; ++x) {
+		float returnR = 0;
+		float returnG = 0;
+		float returnB = 0;
+		bool inside = x >= radius && x + radius < width;
+		for (int i = 0; i < size; ++i) {
+			const QRgb* row = rows[i];
+			for (int j = -radius; j <= radius; ++j) {
+				int idx = i * size + j + radius;
+				QRgb pix = row[inside ? x + j : clamp(x + j, width - 1, 0)];
+
+				returnR += qRed(pix) * mKernel[idx];
+				returnG += qGreen(pix) * mKernel[idx];
+				returnB += qBlue(pix) * mKernel[idx];
+			}
+		}
+		result[x] = qRgb(static_cast<int>(clamp(returnR, 255.f, 0.f)), static_cast<int>(clamp(returnG, 255.f, 0.f)), static_cast<int>(clamp(returnB, 255.f, 0.f)));
+	}
+}
+
+void MatrixFilter::hashParams(Hasher& hasher) const
+{
+	Filter::hashParams(hasher);
+	hasher.add(mKernel.getRadius());
+	for (std::size_t i = 0; i < mKernel.getSize() * mKernel.getSize(); ++i)
+		hasher.add(mKernel[i]);
+}
+
 QColor HistFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	return { 0, 0, 0 };
-}
\ No newline at end of file
+}
+
+QColor HistEqualizationFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+{
+	return img.pixelColor(x, y);
+}
+
+QColor ClaheFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+{
+	return img.pixelColor(x, y);
+}
+
+QColor CannyFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+{
+	return img.pixelColor(x, y);
+}
+
+//  
+
+int MorphologyFilter::getRadius() const
+{
+	return static_cast<int>(std::max(mMask.size(), mMask.front().size()) / 2);
+}
+
+QColor MorphologyFilter::calcNewPixelColor(const QImage& img, int x, int y) const
+{
+	return img.pixelColor(x, y);
+}
+
+void MorphologyFilter::hashParams(Hasher& hasher) const
+{
+	Filter::hashParams(hasher);
+	hashMask(hasher, mMask);
+}
+
+QImage DilatationFilter::processImage(const QImage& img) const
+{
+	return DilatationImpl(img, mMask);
+}
+
+QImage ErosionFilter::processImage(const QImage& img) const
+{
+	return ErosionImpl(img, mMask);
+}
+
+QImage OpenFilter::processImage(const QImage& img) const
+{
+	return OpenImpl(img, mMask);
+}
+
+QImage CloseFilter::processImage(const QImage& img) const
+{
+	return CloseImpl(img, mMask);
+}
+
+QImage GradFilter::processImage(const QImage& img) const
+{
+	return GradImpl(img, mMask);
+}
+
+//  
+
+FilterChain& FilterChain::add(const Filter& filter)
+{
+	filters.push_back(&filter);
+	stages.clear();
+	return *this;
+}
+
+int FilterChain::getRadius() const
+{
+	int radius = 0;
+	for (auto filter : filters)
+		radius += filter->getRadius();
+	return radius;
+}
+
+QImage FilterChain::process(const QImage& img)
+{
+	auto& cache = ResultCache::instance();
+	std::vector<quint64> keys(1, imageKey(img));
+	for (auto filter : filters) {
+		if (!filter->isCacheable())
+			break;
+		keys.push_back(filter->cacheKey(keys.back()));
+	}
+
+	stages.assign(filters.size() + 1, QImage());
+	stages[0] = img;
+	std::size_t start = 0;
+	for (std::size_t i = keys.size() - 1; i > 0; --i) {
+		if (cache.find(keys[i], stages[i])) {
+			start = i;
+			break;
+		}
+	}
+	//    update();      
+	for (std::size_t i = 1; i < start; ++i)
+		cache.find(keys[i], stages[i]);
+	for (std::size_t i = start; i < filters.size(); ++i) {
+		METRICS_SCOPE(ScopedTimer::typeName(typeid(*filters[i]).name()), pixelCount(stages[i]));
+		stages[i + 1] = filters[i]->compute(stages[i]);
+		if (i + 1 < keys.size())
+			cache.insert(keys[i + 1], stages[i + 1]);
+	}
+	return stages.back();
+}
+
+QImage FilterChain::update(const QImage& img, std::vector<QRect> dirty)
+{
+	if (stages.size() != filters.size() + 1 || stages.front().isNull())
+		return process(img);
+	for (std::size_t i = 1; i < stages.size(); ++i) {
+		if (stages[i].isNull()) {
+			METRICS_SCOPE(ScopedTimer::typeName(typeid(*filters[i - 1]).name()), pixelCount(stages[i - 1]));
+			stages[i] = filters[i - 1]->compute(stages[i - 1]);
+		}
+	}
+
+	QImage current = img;
+	for (std::size_t i = 0; i < filters.size() && !dirty.empty(); ++i) {
+		//       ,        
+		bool handOver = i + 1 == filters.size() || !filters[i + 1]->usesPrevImage();
+		QImage prevResult = handOver ? std::move(stages[i + 1]) : stages[i + 1];
+		QImage next = filters[i]->processDirty(current, stages[i], std::move(prevResult), dirty);
+		stages[i] = current;
+		if (handOver)
+			stages[i + 1] = next;
+		current = next;
+	}
+	if (dirty.empty())
+		return stages.back();
+	stages.back() = current;
+	return current;
+}
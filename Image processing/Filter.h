@@ -1,6 +1,13 @@
 #pragma once
 #include <QImage>
+#include <QRect>
+#include <array>
+#include <mutex>
 #include <vector>
+#include <initializer_list>
+
+class Hasher;
+class FilterChain;
 
 //  
 
@@ -12,74 +19,183 @@ QImage Grad(const QImage& img, std::vector<std::vector<bool>> mask);
 
 class Filter
 {
+	friend class FilterChain;
 protected:
 	virtual QColor calcNewPixelColor(const QImage& img, int x, int y) const = 0;
+	virtual QImage processImage(const QImage& img) const;
+	QImage compute(const QImage& img) const;
+	//        
+	static QImage compute(const Filter& filter, const QImage& img) { return filter.compute(img); }
+	virtual void hashParams(Hasher& hasher) const;
 	float RedAvg(const QImage& img) const;
 	float GreenAvg(const QImage& img) const;
 	float BlueAvg(const QImage& img) const;
 public:
 	virtual ~Filter() = default;
-	virtual QImage process(const QImage& img) const;
+	QImage process(const QImage& img) const;
+	quint64 cacheKey(quint64 inputKey) const;
+	virtual bool isCacheable() const { return true; }
+	virtual int getRadius() const { return 0; }
+	// dirty:   -   img  prevImg,   -   .
+	// prevResult   ,       
+	virtual QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const;
+	// processDirty   prevImg,     
+	virtual bool usesPrevImage() const { return false; }
+};
+
+//    ,  - QImage::cacheKey()
+template <class T>
+class StatsMemo
+{
+	mutable std::mutex mutex;
+	mutable qint64 key = 0;
+	mutable bool valid = false;
+	mutable T value;
+public:
+	bool find(const QImage& img, T& result) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!valid || key != img.cacheKey())
+			return false;
+		result = value;
+		return true;
+	}
+	void store(const QImage& img, const T& stats) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		key = img.cacheKey();
+		value = stats;
+		valid = true;
+	}
 };
 
+typedef std::array<qint64, 3> ChannelSums;
+typedef std::array<quint32, 256> ValueHistogram;
+
 // 
 
-class InvertFilter : public Filter
+class PointFilter : public Filter
 {
+protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	virtual QColor calcNewColor(const QColor& src) const = 0;
+public:
+	void processRow(QRgb* row, int width) const;
 };
 
-class GrayScaleFilter : public Filter
+class InvertFilter : public PointFilter
 {
-	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QColor calcNewColor(const QColor& src) const override;
 };
 
-class Sepia : public Filter
+class GrayScaleFilter : public PointFilter
 {
-	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QColor calcNewColor(const QColor& src) const override;
 };
 
-class Brightness : public Filter
+class Sepia : public PointFilter
 {
-	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QColor calcNewColor(const QColor& src) const override;
+};
+
+class Brightness : public PointFilter
+{
+	QColor calcNewColor(const QColor& src) const override;
 };
 
 class GrayWorld : public Filter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+	void processRect(const QImage& img, QImage& result, const QRect& rect, float R, float G, float B) const;
+	StatsMemo<ChannelSums> sums;
 public:
-	QImage process(const QImage& img) const override;
+	bool usesPrevImage() const override { return true; }
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
 };
 
 class BaseColor : public Filter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
 public:
-	QImage process(const QImage& img) const override;
+	bool isCacheable() const override { return false; }
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
 };
 
 class Shift : public Filter
 {
+	static const int offset = 50;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+	void processRect(const QImage& img, QImage& result, const QRect& rect) const;
 public:
-	QImage process(const QImage& img) const override;
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
 };
 
 class Glass_effect : public Filter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+public:
+	bool isCacheable() const override { return false; }
+	int getRadius() const override { return 5; }
 };
 
 class MedianFilter : public Filter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+public:
+	int getRadius() const override { return 2; }
 };
 
 class HistFilter : public Filter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+	void processRect(const QImage& img, QImage& result, const QRect& rect, int v_min, int v_max) const;
+	StatsMemo<ValueHistogram> histogram;
 public:
-	QImage process(const QImage& img) const override;
+	bool usesPrevImage() const override { return true; }
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
+};
+
+class HistEqualizationFilter : public Filter
+{
+	StatsMemo<ValueHistogram> histogram;
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+public:
+	bool usesPrevImage() const override { return true; }
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
+};
+
+// -  :     ,
+//     
+class ClaheFilter : public Filter
+{
+	struct Grid
+	{
+		int tileW;
+		int tileH;
+		int countX;
+		int countY;
+	};
+	int tilesX;
+	int tilesY;
+	float clipLimit;
+	//     
+	StatsMemo<std::vector<uchar>> tables;
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+	void hashParams(Hasher& hasher) const override;
+	Grid makeGrid(const QImage& img) const;
+	void tileLut(const QImage& img, const Grid& grid, int tile, uchar* lut) const;
+	std::vector<uchar> tileLuts(const QImage& img, const Grid& grid) const;
+	void processRect(const QImage& img, QImage& result, const QRect& rect, const Grid& grid, const std::vector<uchar>& luts) const;
+public:
+	ClaheFilter(int tilesX = 8, int tilesY = 8, float clipLimit = 2.f) : tilesX(tilesX), tilesY(tilesY), clipLimit(clipLimit) {}
+	bool usesPrevImage() const override { return true; }
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
 };
 
 // 
@@ -249,9 +365,14 @@ class MatrixFilter : public Filter
 protected:
 	Kernel mKernel;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	void hashParams(Hasher& hasher) const override;
 public:
 	MatrixFilter(const Kernel& kernel) : mKernel(kernel) {};
 	virtual ~MatrixFilter() = default;
+	int getRadius() const override { return static_cast<int>(mKernel.getRadius()); }
+	virtual bool isFusable() const { return true; }
+	// rows - 2 * radius + 1        
+	void processRow(const QRgb* const* rows, QRgb* result, int width) const;
 };
 
 // 
@@ -284,9 +405,11 @@ public:
 
 class SobelFilter : public MatrixFilter
 {
+	QImage processImage(const QImage& img) const override;
 public:
 	SobelFilter() : MatrixFilter(Kernel(0)) {}
-	QImage process(const QImage& img) const override;
+	int getRadius() const override { return 1; }
+	bool isFusable() const override { return false; }
 };
 
 //
@@ -305,9 +428,30 @@ public:
 
 class PrewittFilter : public MatrixFilter
 {
+	QImage processImage(const QImage& img) const override;
 public:
 	PrewittFilter() : MatrixFilter(Kernel(0)) {}
-	QImage process(const QImage& img) const override;
+	int getRadius() const override { return 1; }
+	bool isFusable() const override { return false; }
+};
+
+// 
+
+class CannyFilter : public Filter
+{
+	float low;
+	float high;
+	std::size_t radius;
+	float sigma;
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QImage processImage(const QImage& img) const override;
+	void hashParams(Hasher& hasher) const override;
+public:
+	// low  high -      , radius  sigma -  GaussianFilter
+	CannyFilter(float low = 40.f, float high = 100.f, std::size_t radius = 2, float sigma = 2.f) : low(low), high(high), radius(radius), sigma(sigma) {}
+	QImage processDirty(const QImage& img, const QImage& prevImg, QImage prevResult, std::vector<QRect>& dirty) const override;
+	//    - .  edges ,       
+	QImage detect(const QImage& img, std::vector<std::vector<QPoint>>* edges = nullptr) const;
 };
 
 //
@@ -324,3 +468,69 @@ public:
 	MoreSharpnessFilter() : MatrixFilter(SharpnessKernel()) {}
 };
 
+//  
+
+class MorphologyFilter : public Filter
+{
+protected:
+	std::vector<std::vector<bool>> mMask;
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	void hashParams(Hasher& hasher) const override;
+public:
+	MorphologyFilter(std::vector<std::vector<bool>> mask) : mMask(std::move(mask)) {}
+	int getRadius() const override;
+};
+
+class DilatationFilter : public MorphologyFilter
+{
+	QImage processImage(const QImage& img) const override;
+public:
+	using MorphologyFilter::MorphologyFilter;
+};
+
+class ErosionFilter : public MorphologyFilter
+{
+	QImage processImage(const QImage& img) const override;
+public:
+	using MorphologyFilter::MorphologyFilter;
+};
+
+class OpenFilter : public MorphologyFilter
+{
+	QImage processImage(const QImage& img) const override;
+public:
+	using MorphologyFilter::MorphologyFilter;
+	int getRadius() const override { return 2 * MorphologyFilter::getRadius(); }
+};
+
+class CloseFilter : public MorphologyFilter
+{
+	QImage processImage(const QImage& img) const override;
+public:
+	using MorphologyFilter::MorphologyFilter;
+	int getRadius() const override { return 2 * MorphologyFilter::getRadius(); }
+};
+
+class GradFilter : public MorphologyFilter
+{
+	QImage processImage(const QImage& img) const override;
+public:
+	using MorphologyFilter::MorphologyFilter;
+};
+
+//  
+
+class FilterChain
+{
+	std::vector<const Filter*> filters;
+	std::vector<QImage> stages;
+public:
+	FilterChain(std::initializer_list<const Filter*> filters = {}) : filters(filters) {}
+	FilterChain& add(const Filter& filter);
+	//     :    
+	FilterChain& add(const Filter&& filter) = delete;
+	int getRadius() const;
+	QImage process(const QImage& img);
+	QImage update(const QImage& img, std::vector<QRect> dirty);
+};
+
@@ -0,0 +1,138 @@
+#include "ImageIO.h"
+#include "Metrics.h"
+#include <algorithm>
+
+QImage loadImage(const QString& path)
+{
+	METRICS_SCOPE("load", 0);
+	QImage img;
+	img.load(path);
+	METRICS_PIXELS(static_cast<qint64>(img.width()) * img.height());
+	METRICS_ALLOC(img.sizeInBytes());
+	return img;
+}
+
+static QString withSuffix(const QString& path, const char* suffix)
+{
+	int dot = path.lastIndexOf('.');
+	int slash = std::max(path.lastIndexOf('/'), path.lastIndexOf('\\'));
+	return (dot > slash ? path.left(dot) : path) + "." + suffix;
+}
+
+bool saveImage(const QImage& img, const QString& path, ImageFormat format, int level)
+{
+	METRICS_SCOPE("save", static_cast<qint64>(img.width()) * img.height());
+	switch (format) {
+	case ImageFormat::Ppm:
+		return img.save(withSuffix(path, "ppm"), "PPM");
+	case ImageFormat::FastPng:
+		level = 1;
+		break;
+	case ImageFormat::Png:
+		break;
+	}
+	// Qt  quality     (100 - quality) * 9 / 91
+	int quality = level < 0 ? -1 : 100 - (std::min(level, 9) * 91 + 8) / 9;
+	return img.save(path, "PNG", quality);
+}
+
+//  
+
+AsyncImageWriter::AsyncImageWriter(ImageFormat format, int level, unsigned threads, qint64 maxBytes)
+	: format(format), level(level), maxBytes(maxBytes)
+{
+	if (threads == 0) {
+		unsigned cores = std::thread::hardware_concurrency();
+		threads = cores > 1 ? cores - 1 : 1;
+	}
+	maxQueue = 2 * threads;
+	for (unsigned i = 0; i < threads; ++i)
+		workers.emplace_back(&AsyncImageWriter::run, this);
+}
+
+AsyncImageWriter::~AsyncImageWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void AsyncImageWriter::save(const QImage& img, const QString& path)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	//    ,      
+	qint64 bytes = img.sizeInBytes();
+	done.wait(lock, [this, bytes] { return queue.size() < maxQueue && (pendingBytes == 0 || pendingBytes + bytes <= maxBytes); });
+	pendingBytes += bytes;
+	queue.push_back({ img, path });
+	lock.unlock();
+	ready.notify_one();
+}
+
+void AsyncImageWriter::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return queue.empty() && active == 0; });
+}
+
+std::size_t AsyncImageWriter::failures()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return failed;
+}
+
+void AsyncImageWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		ready.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (queue.empty())
+			return;
+		Task task = std::move(queue.front());
+		queue.pop_front();
+		active++;
+		lock.unlock();
+		done.notify_all();
+
+		bool ok = saveImage(task.img, task.path, format, level);
+		qint64 bytes = task.img.sizeInBytes();
+		task.img = QImage();
+
+		lock.lock();
+		active--;
+		pendingBytes -= bytes;
+		if (!ok)
+			failed++;
+		done.notify_all();
+	}
+}
+
+//  
+
+ImagePrefetcher::ImagePrefetcher(std::vector<QString> paths, std::size_t lookahead)
+	: paths(std::move(paths)), lookahead(std::max<std::size_t>(1, lookahead))
+{
+	fill();
+}
+
+void ImagePrefetcher::fill()
+{
+	while (pending.size() < lookahead && started < paths.size()) {
+		QString path = paths[started++];
+		pending.push_back(std::async(std::launch::async, [path] { return loadImage(path); }));
+	}
+}
+
+bool ImagePrefetcher::next(QImage& img)
+{
+	if (pending.empty())
+		return false;
+	img = pending.front().get();
+	pending.pop_front();
+	fill();
+	return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <QImage>
+#include <QString>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//   
+
+enum class ImageFormat { Png, FastPng, Ppm };
+
+QImage loadImage(const QString& path);
+// level -   PNG  0  9, -1 -  
+bool saveImage(const QImage& img, const QString& path, ImageFormat format = ImageFormat::Png, int level = -1);
+
+//  
+
+class AsyncImageWriter
+{
+	struct Task
+	{
+		QImage img;
+		QString path;
+	};
+	ImageFormat format;
+	int level;
+	std::size_t maxQueue;
+	//        -     
+	qint64 maxBytes;
+	qint64 pendingBytes = 0;
+	std::deque<Task> queue;
+	std::size_t active = 0;
+	std::size_t failed = 0;
+	bool stopping = false;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable done;
+	std::vector<std::thread> workers;
+	void run();
+public:
+	AsyncImageWriter(ImageFormat format = ImageFormat::Png, int level = -1, unsigned threads = 0, qint64 maxBytes = 512ll << 20);
+	AsyncImageWriter(const AsyncImageWriter&) = delete;
+	AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+	~AsyncImageWriter();
+	void save(const QImage& img, const QString& path);
+	void wait();
+	std::size_t failures();
+};
+
+//  
+
+class ImagePrefetcher
+{
+	std::vector<QString> paths;
+	std::size_t lookahead;
+	std::size_t started = 0;
+	std::deque<std::future<QImage>> pending;
+	void fill();
+public:
+	ImagePrefetcher(std::vector<QString> paths, std::size_t lookahead = 2);
+	bool next(QImage& img);
+};
@@ -0,0 +1,120 @@
+#include "LazyChain.h"
+#include "Metrics.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+//  
+
+namespace
+{
+	class RowStage
+	{
+	public:
+		std::vector<const PointFilter*> post;
+		virtual ~RowStage() = default;
+		virtual void fetch(int y, QRgb* dst) = 0;
+	protected:
+		void applyPost(QRgb* dst, int width) const
+		{
+			for (auto filter : post)
+				filter->processRow(dst, width);
+		}
+	};
+
+	class SourceStage : public RowStage
+	{
+		const QImage& img;
+	public:
+		SourceStage(const QImage& img) : img(img) {}
+		void fetch(int y, QRgb* dst) override
+		{
+			std::memcpy(dst, img.constScanLine(y), img.width() * sizeof(QRgb));
+			applyPost(dst, img.width());
+		}
+	};
+
+	class MatrixStage : public RowStage
+	{
+		std::unique_ptr<RowStage> upstream;
+		const MatrixFilter* filter;
+		int width;
+		int height;
+		int radius;
+		int next = 0;
+		std::vector<QRgb> ring;
+		std::vector<const QRgb*> rows;
+	public:
+		MatrixStage(std::unique_ptr<RowStage> upstream, const MatrixFilter* filter, int width, int height)
+			: upstream(std::move(upstream)), filter(filter), width(width), height(height), radius(filter->getRadius()),
+			ring(static_cast<std::size_t>(2 * radius + 1) * width), rows(2 * radius + 1)
+		{
+		}
+		void fetch(int y, QRgb* dst) override
+		{
+			int size = 2 * radius + 1;
+			for (; next <= std::min(y + radius, height - 1); ++next)
+				upstream->fetch(next, &ring[static_cast<std::size_t>(next % size) * width]);
+			for (int i = 0; i < size; ++i) {
+				int row = std::min(std::max(y + i - radius, 0), height - 1);
+				rows[i] = &ring[static_cast<std::size_t>(row % size) * width];
+			}
+			filter->processRow(rows.data(), dst, width);
+			applyPost(dst, width);
+		}
+	};
+}
+
+static bool isFusable(const Filter* filter)
+{
+	if (dynamic_cast<const PointFilter*>(filter))
+		return true;
+	auto matrix = dynamic_cast<const MatrixFilter*>(filter);
+	return matrix && matrix->isFusable();
+}
+
+static QImage evalSegment(const QImage& img, std::vector<const Filter*>::const_iterator first, std::vector<const Filter*>::const_iterator last)
+{
+	QImage src = img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32 ? img : img.convertToFormat(QImage::Format_ARGB32);
+	std::unique_ptr<RowStage> stage(new SourceStage(src));
+	for (auto it = first; it != last; ++it) {
+		if (auto point = dynamic_cast<const PointFilter*>(*it))
+			stage->post.push_back(point);
+		else
+			stage.reset(new MatrixStage(std::move(stage), dynamic_cast<const MatrixFilter*>(*it), src.width(), src.height()));
+	}
+
+	QImage result = BufferPool::instance().image(src.width(), src.height(), src.format());
+	METRICS_ALLOC(result.sizeInBytes());
+	for (int y = 0; y < src.height(); ++y)
+		stage->fetch(y, reinterpret_cast<QRgb*>(result.scanLine(y)));
+	return result;
+}
+
+//   
+
+LazyChain LazyChain::then(const Filter& filter) const
+{
+	LazyChain result(*this);
+	result.filters.push_back(&filter);
+	return result;
+}
+
+QImage LazyChain::eval() const
+{
+	METRICS_SCOPE("LazyChain", static_cast<qint64>(source.width()) * source.height());
+	QImage current = source;
+	auto it = filters.begin();
+	while (it != filters.end()) {
+		auto end = std::find_if_not(it, filters.end(), isFusable);
+		if (end == it) {
+			current = (*it)->process(current);
+			++it;
+			continue;
+		}
+		current = evalSegment(current, it, end);
+		it = end;
+	}
+	return current;
+}
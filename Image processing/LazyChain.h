@@ -0,0 +1,26 @@
+#pragma once
+#include <QImage>
+#include <vector>
+#include "Filter.h"
+
+//   
+
+class LazyChain
+{
+	QImage source;
+	std::vector<const Filter*> filters;
+public:
+	LazyChain(const QImage& img) : source(img) {}
+	//     :    
+	LazyChain then(const Filter& filter) const;
+	LazyChain then(const Filter&& filter) const = delete;
+	QImage eval() const;
+	operator QImage() const { return eval(); }
+};
+
+inline LazyChain operator|(const LazyChain& chain, const Filter& filter)
+{
+	return chain.then(filter);
+}
+
+LazyChain operator|(const LazyChain& chain, const Filter&& filter) = delete;
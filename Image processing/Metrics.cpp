@@ -0,0 +1,263 @@
+#include "Metrics.h"
+#include "BufferPool.h"
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+#ifdef __GNUG__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+//  
+
+qint64 ScopedTimer::threadCpuNs()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return static_cast<qint64>(k.QuadPart + u.QuadPart) * 100;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return static_cast<qint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// 
+
+static thread_local ScopedTimer* currentTimer = nullptr;
+
+ScopedTimer::ScopedTimer(const char* name, qint64 pixels)
+	: name(name), pixels(pixels), wallStart(std::chrono::steady_clock::now()), cpuStart(threadCpuNs()), parent(currentTimer)
+{
+	currentTimer = this;
+}
+
+ScopedTimer::~ScopedTimer()
+{
+	qint64 wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wallStart).count();
+	Metrics::instance().record(name, wall, threadCpuNs() - cpuStart + workerCpu, pixels, bytes);
+	if (parent) {
+		parent->bytes += bytes;
+		parent->workerCpu += workerCpu;
+	}
+	currentTimer = parent;
+}
+
+void ScopedTimer::addBytes(qint64 bytes)
+{
+	if (currentTimer)
+		currentTimer->bytes += bytes;
+}
+
+void ScopedTimer::addPixels(qint64 pixels)
+{
+	if (currentTimer)
+		currentTimer->pixels += pixels;
+}
+
+void ScopedTimer::addCpu(qint64 ns)
+{
+	if (currentTimer)
+		currentTimer->workerCpu += ns;
+}
+
+static std::string demangle(const char* name)
+{
+#ifdef __GNUG__
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+	if (status == 0 && demangled) {
+		std::string result(demangled);
+		std::free(demangled);
+		return result;
+	}
+#endif
+	std::string result(name);
+	for (const char* prefix : { "class ", "struct " }) {
+		if (result.compare(0, std::strlen(prefix), prefix) == 0)
+			return result.substr(std::strlen(prefix));
+	}
+	return result;
+}
+
+const char* ScopedTimer::typeName(const char* name)
+{
+	static std::mutex mutex;
+	static std::unordered_map<const char*, std::string> names;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = names.find(name);
+	if (it == names.end())
+		it = names.emplace(name, demangle(name)).first;
+	return it->second.c_str();
+}
+
+//   
+
+const double Metrics::BOUNDS[Metrics::BUCKETS] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60 };
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+void Metrics::record(const char* name, qint64 wallNs, qint64 cpuNs, qint64 pixels, qint64 bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = stats.find(name);
+	if (it == stats.end())
+		it = stats.emplace(name, Stats()).first;
+	Stats& s = it->second;
+	s.calls++;
+	s.wallNs += wallNs;
+	s.cpuNs += cpuNs;
+	s.pixels += pixels;
+	s.bytes += bytes;
+	for (int i = 0; i < BUCKETS; ++i) {
+		if (wallNs <= BOUNDS[i] * 1e9) {
+			s.histogram[i]++;
+			break;
+		}
+	}
+}
+
+void Metrics::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.clear();
+}
+
+Metrics::StatsMap Metrics::snapshot() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+static double utilization(const Metrics::Stats& s)
+{
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	return s.wallNs > 0 ? static_cast<double>(s.cpuNs) / s.wallNs / cores : 0.0;
+}
+
+static double hitRate(const BufferPool::Stats& s)
+{
+	return s.requests > 0 ? static_cast<double>(s.hits) / s.requests : 0.0;
+}
+
+QString Metrics::toJson() const
+{
+	auto data = snapshot();
+	std::ostringstream out;
+	out << "{\n\t\"cores\": " << std::max(1u, std::thread::hardware_concurrency()) << ",\n\t\"stages\": [";
+	bool first = true;
+	for (const auto& entry : data) {
+		const Stats& s = entry.second;
+		out << (first ? "\n" : ",\n");
+		first = false;
+		out << "\t\t{\n"
+			<< "\t\t\t\"name\": \"" << entry.first << "\",\n"
+			<< "\t\t\t\"calls\": " << s.calls << ",\n"
+			<< "\t\t\t\"wall_seconds\": " << s.wallNs / 1e9 << ",\n"
+			<< "\t\t\t\"cpu_seconds\": " << s.cpuNs / 1e9 << ",\n"
+			<< "\t\t\t\"pixels\": " << s.pixels << ",\n"
+			<< "\t\t\t\"allocated_bytes\": " << s.bytes << ",\n"
+			<< "\t\t\t\"thread_utilization\": " << utilization(s) << ",\n"
+			<< "\t\t\t\"wall_histogram\": [";
+		for (int i = 0; i < BUCKETS; ++i)
+			out << (i ? ", " : "") << "{ \"le\": " << BOUNDS[i] << ", \"count\": " << s.histogram[i] << " }";
+		out << "]\n\t\t}";
+	}
+	BufferPool::Stats pool = BufferPool::instance().stats();
+	out << "\n\t],\n\t\"buffer_pool\": {\n"
+		<< "\t\t\"requests\": " << pool.requests << ",\n"
+		<< "\t\t\"hits\": " << pool.hits << ",\n"
+		<< "\t\t\"hit_rate\": " << hitRate(pool) << ",\n"
+		<< "\t\t\"used_bytes\": " << pool.usedBytes << ",\n"
+		<< "\t\t\"pooled_bytes\": " << pool.pooledBytes << ",\n"
+		<< "\t\t\"peak_bytes\": " << pool.peakBytes << "\n"
+		<< "\t}\n}\n";
+	return QString::fromStdString(out.str());
+}
+
+QString Metrics::toPrometheus() const
+{
+	auto data = snapshot();
+	std::ostringstream out;
+
+	out << "# HELP image_processing_wall_seconds Wall time of a filter, morphology or I/O call.\n"
+		<< "# TYPE image_processing_wall_seconds histogram\n";
+	for (const auto& entry : data) {
+		const Stats& s = entry.second;
+		qint64 cumulative = 0;
+		for (int i = 0; i < BUCKETS; ++i) {
+			cumulative += s.histogram[i];
+			out << "image_processing_wall_seconds_bucket{stage=\"" << entry.first << "\",le=\"" << BOUNDS[i] << "\"} " << cumulative << "\n";
+		}
+		out << "image_processing_wall_seconds_bucket{stage=\"" << entry.first << "\",le=\"+Inf\"} " << s.calls << "\n"
+			<< "image_processing_wall_seconds_sum{stage=\"" << entry.first << "\"} " << s.wallNs / 1e9 << "\n"
+			<< "image_processing_wall_seconds_count{stage=\"" << entry.first << "\"} " << s.calls << "\n";
+	}
+
+	auto counter = [&](const char* metric, const char* help, const char* type, double (*value)(const Stats&)) {
+		out << "# HELP " << metric << " " << help << "\n# TYPE " << metric << " " << type << "\n";
+		for (const auto& entry : data)
+			out << metric << "{stage=\"" << entry.first << "\"} " << value(entry.second) << "\n";
+	};
+	counter("image_processing_cpu_seconds_total", "CPU time of the calling thread and its parallel workers.", "counter",
+		[](const Stats& s) { return s.cpuNs / 1e9; });
+	counter("image_processing_pixels_total", "Pixels processed.", "counter",
+		[](const Stats& s) { return static_cast<double>(s.pixels); });
+	counter("image_processing_allocated_bytes_total", "Bytes allocated for intermediate images.", "counter",
+		[](const Stats& s) { return static_cast<double>(s.bytes); });
+	counter("image_processing_thread_utilization", "CPU time divided by wall time and core count.", "gauge",
+		[](const Stats& s) { return utilization(s); });
+
+	BufferPool::Stats pool = BufferPool::instance().stats();
+	auto gauge = [&](const char* metric, const char* help, const char* type, double value) {
+		out << "# HELP " << metric << " " << help << "\n# TYPE " << metric << " " << type << "\n" << metric << " " << value << "\n";
+	};
+	gauge("image_processing_buffer_pool_requests_total", "Buffers requested from the pool.", "counter", static_cast<double>(pool.requests));
+	gauge("image_processing_buffer_pool_hits_total", "Buffer requests served without a system allocation.", "counter", static_cast<double>(pool.hits));
+	gauge("image_processing_buffer_pool_hit_rate", "Share of buffer requests served from the pool.", "gauge", hitRate(pool));
+	gauge("image_processing_buffer_pool_used_bytes", "Bytes of pooled buffers currently in use.", "gauge", static_cast<double>(pool.usedBytes));
+	gauge("image_processing_buffer_pool_pooled_bytes", "Bytes of free buffers kept for reuse.", "gauge", static_cast<double>(pool.pooledBytes));
+	gauge("image_processing_buffer_pool_peak_bytes", "Peak of used plus pooled bytes.", "gauge", static_cast<double>(pool.peakBytes));
+	return QString::fromStdString(out.str());
+}
+
+static bool writeFile(const QString& path, const QString& text)
+{
+	QSaveFile file(path);
+	if (!file.open(QFile::WriteOnly))
+		return false;
+	std::string data = text.toStdString();
+	if (file.write(data.data(), data.size()) != static_cast<qint64>(data.size()))
+		return false;
+	return file.commit();
+}
+
+bool Metrics::saveJson(const QString& path) const
+{
+	return writeFile(path, toJson());
+}
+
+bool Metrics::savePrometheus(const QString& path) const
+{
+	return writeFile(path, toPrometheus());
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <QString>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+//  
+
+class Metrics
+{
+public:
+	static const int BUCKETS = 10;
+	static const double BOUNDS[BUCKETS];
+
+	struct Stats
+	{
+		qint64 calls = 0;
+		qint64 wallNs = 0;
+		qint64 cpuNs = 0;
+		qint64 pixels = 0;
+		qint64 bytes = 0;
+		qint64 histogram[BUCKETS] = {};
+	};
+	typedef std::map<std::string, Stats, std::less<>> StatsMap;
+
+	static Metrics& instance();
+	void record(const char* name, qint64 wallNs, qint64 cpuNs, qint64 pixels, qint64 bytes);
+	void reset();
+	StatsMap snapshot() const;
+	QString toJson() const;
+	QString toPrometheus() const;
+	bool saveJson(const QString& path) const;
+	bool savePrometheus(const QString& path) const;
+private:
+	Metrics() = default;
+	StatsMap stats;
+	mutable std::mutex mutex;
+};
+
+class ScopedTimer
+{
+	const char* name;
+	qint64 pixels;
+	qint64 bytes = 0;
+	qint64 workerCpu = 0;
+	std::chrono::steady_clock::time_point wallStart;
+	qint64 cpuStart;
+	ScopedTimer* parent;
+public:
+	ScopedTimer(const char* name, qint64 pixels = 0);
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+	~ScopedTimer();
+	static void addBytes(qint64 bytes);
+	static void addPixels(qint64 pixels);
+	//  ,       
+	static void addCpu(qint64 ns);
+	static qint64 threadCpuNs();
+	//    ;      
+	static const char* typeName(const char* name);
+};
+
+#ifdef IMAGE_PROCESSING_METRICS
+#define METRICS_CONCAT_(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT_(a, b)
+#define METRICS_SCOPE(name, pixels) ScopedTimer METRICS_CONCAT(metricsTimer, __LINE__)(name, pixels)
+#define METRICS_ALLOC(bytes) ScopedTimer::addBytes(bytes)
+#define METRICS_PIXELS(pixels) ScopedTimer::addPixels(pixels)
+#define METRICS_CPU(ns) ScopedTimer::addCpu(ns)
+#else
+#define METRICS_SCOPE(name, pixels) ((void)0)
+#define METRICS_ALLOC(bytes) ((void)0)
+#define METRICS_PIXELS(pixels) ((void)0)
+#define METRICS_CPU(ns) ((void)0)
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+#include "Metrics.h"
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+//  
+
+inline int threadCount()
+{
+	unsigned cores = std::thread::hardware_concurrency();
+	return cores ? static_cast<int>(cores) : 1;
+}
+
+// body(first, last)        [first, last)
+template <class F>
+void parallelFor(int begin, int end, F body, int grain = 1)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+	int chunks = std::min(threadCount(), (count + grain - 1) / grain);
+	if (chunks <= 1) {
+		body(begin, end);
+		return;
+	}
+	std::vector<std::thread> threads;
+	threads.reserve(chunks - 1);
+#ifdef IMAGE_PROCESSING_METRICS
+	std::vector<qint64> cpu(chunks - 1);
+#endif
+	for (int i = 1; i < chunks; ++i) {
+		int first = begin + static_cast<int>(static_cast<long long>(count) * i / chunks);
+		int last = begin + static_cast<int>(static_cast<long long>(count) * (i + 1) / chunks);
+#ifdef IMAGE_PROCESSING_METRICS
+		threads.emplace_back([first, last, &body, &time = cpu[i - 1]] {
+			qint64 start = ScopedTimer::threadCpuNs();
+			body(first, last);
+			time = ScopedTimer::threadCpuNs() - start;
+		});
+#else
+		threads.emplace_back([first, last, &body] { body(first, last); });
+#endif
+	}
+	body(begin, begin + count / chunks);
+	for (auto& thread : threads)
+		thread.join();
+#ifdef IMAGE_PROCESSING_METRICS
+	//         -     
+	METRICS_CPU(std::accumulate(cpu.begin(), cpu.end(), qint64(0)));
+#endif
+}
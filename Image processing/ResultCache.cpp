@@ -0,0 +1,281 @@
+#include "ResultCache.h"
+#include "BufferPool.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QVector>
+#include <cstring>
+
+// 
+
+static inline quint64 rotl(quint64 value, int shift)
+{
+	return (value << shift) | (value >> (64 - shift));
+}
+
+static inline quint64 mix(quint64 h, quint64 word)
+{
+	return rotl(h ^ (word * 0x87C37B91114253D5ull), 31) * 0x4CF5AD432745937Full;
+}
+
+Hasher& Hasher::add(const void* data, std::size_t len)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+	std::size_t i = 0;
+	if (len >= 32) {
+		quint64 lanes[4] = { state, state ^ 0x1ull, state ^ 0x2ull, state ^ 0x3ull };
+		for (; i + 32 <= len; i += 32) {
+			quint64 words[4];
+			std::memcpy(words, bytes + i, 32);
+			for (int k = 0; k < 4; ++k)
+				lanes[k] = mix(lanes[k], words[k]);
+		}
+		state = mix(mix(mix(mix(state, lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+	}
+	for (; i + 8 <= len; i += 8) {
+		quint64 word;
+		std::memcpy(&word, bytes + i, 8);
+		state = mix(state, word);
+	}
+	quint64 tail = 0;
+	std::memcpy(&tail, bytes + i, len - i);
+	state = mix(state, tail ^ (static_cast<quint64>(len) << 56));
+	return *this;
+}
+
+Hasher& Hasher::add(const char* str)
+{
+	return add(str, std::strlen(str));
+}
+
+Hasher& Hasher::add(const QImage& img)
+{
+	add(img.width());
+	add(img.height());
+	add(static_cast<int>(img.format()));
+	if (img.colorCount() > 0) {
+		QVector<QRgb> table = img.colorTable();
+		add(table.constData(), table.size() * sizeof(QRgb));
+	}
+	std::size_t lineLen = (static_cast<std::size_t>(img.width()) * img.depth() + 7) / 8;
+	for (int y = 0; y < img.height(); ++y)
+		add(img.constScanLine(y), lineLen);
+	return *this;
+}
+
+quint64 Hasher::result() const
+{
+	quint64 h = state;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+//  
+
+namespace
+{
+	struct DiskHeader
+	{
+		quint32 magic;
+		quint32 version;
+		qint32 width;
+		qint32 height;
+		qint32 format;
+		qint32 colorCount;
+	};
+	const quint32 DISK_MAGIC = 0x32435049; // "IPC2"
+}
+
+ResultCache& ResultCache::instance()
+{
+	static ResultCache cache;
+	return cache;
+}
+
+void ResultCache::setMemoryLimit(qint64 bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	memoryLimit = bytes;
+	evict();
+}
+
+void ResultCache::setDiskTier(const QString& path, qint64 bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	disk.clear();
+	diskIndex.clear();
+	diskUsed = 0;
+	diskPath = path;
+	diskLimit = bytes;
+	if (diskPath.isEmpty())
+		return;
+
+	QDir dir(diskPath);
+	dir.mkpath(".");
+	for (const QFileInfo& info : dir.entryInfoList({ "*.ipc" }, QDir::Files, QDir::Time | QDir::Reversed)) {
+		bool ok = false;
+		quint64 key = info.completeBaseName().toULongLong(&ok, 16);
+		if (!ok)
+			continue;
+		disk.push_front({ key, info.size() });
+		diskIndex[key] = disk.begin();
+		diskUsed += info.size();
+	}
+	evict();
+}
+
+void ResultCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	memory.clear();
+	memoryIndex.clear();
+	memoryUsed = 0;
+}
+
+bool ResultCache::find(quint64 key, QImage& image)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = memoryIndex.find(key);
+	if (it != memoryIndex.end()) {
+		memory.splice(memory.begin(), memory, it->second);
+		image = it->second->image;
+		return true;
+	}
+	if (!readDisk(key, image))
+		return false;
+	insertMemory(key, image);
+	evict();
+	return true;
+}
+
+//      -1
+static qint64 writeDisk(const QString& path, const QImage& image)
+{
+	QSaveFile file(path);
+	if (!file.open(QFile::WriteOnly))
+		return -1;
+
+	DiskHeader header{ DISK_MAGIC, ResultCache::ALGORITHM_VERSION, image.width(), image.height(), static_cast<qint32>(image.format()), image.colorCount() };
+	bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+	if (header.colorCount > 0) {
+		QVector<QRgb> table = image.colorTable();
+		qint64 tableLen = static_cast<qint64>(table.size()) * static_cast<qint64>(sizeof(QRgb));
+		ok = ok && file.write(reinterpret_cast<const char*>(table.constData()), tableLen) == tableLen;
+	}
+	qint64 lineLen = (static_cast<qint64>(image.width()) * image.depth() + 7) / 8;
+	for (int y = 0; ok && y < image.height(); ++y)
+		ok = file.write(reinterpret_cast<const char*>(image.constScanLine(y)), lineLen) == lineLen;
+	if (!ok || !file.commit())
+		return -1;
+	return sizeof(header) + header.colorCount * sizeof(QRgb) + lineLen * image.height();
+}
+
+void ResultCache::insert(quint64 key, const QImage& image)
+{
+	if (image.isNull())
+		return;
+	QString path;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		insertMemory(key, image);
+		evict();
+		if (diskPath.isEmpty() || diskIndex.count(key) || !writing.insert(key).second)
+			return;
+		path = filePath(key);
+	}
+
+	//       :      
+	qint64 size = writeDisk(path, image);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	writing.erase(key);
+	if (size < 0)
+		return;
+	if (diskPath.isEmpty() || filePath(key) != path) {
+		//  ,      
+		QFile::remove(path);
+		return;
+	}
+	disk.push_front({ key, size });
+	diskIndex[key] = disk.begin();
+	diskUsed += size;
+	evict();
+}
+
+QString ResultCache::filePath(quint64 key) const
+{
+	return QDir(diskPath).filePath(QString::number(key, 16) + ".ipc");
+}
+
+void ResultCache::insertMemory(quint64 key, const QImage& image)
+{
+	qint64 size = image.sizeInBytes();
+	if (size > memoryLimit)
+		return;
+	auto it = memoryIndex.find(key);
+	if (it != memoryIndex.end()) {
+		memoryUsed -= it->second->size;
+		memory.erase(it->second);
+	}
+	memory.push_front({ key, image, size });
+	memoryIndex[key] = memory.begin();
+	memoryUsed += size;
+}
+
+bool ResultCache::readDisk(quint64 key, QImage& image)
+{
+	auto it = diskIndex.find(key);
+	if (it == diskIndex.end())
+		return false;
+
+	QFile file(filePath(key));
+	DiskHeader header;
+	bool ok = file.open(QFile::ReadOnly)
+		&& file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header)
+		&& header.magic == DISK_MAGIC
+		&& header.version == ALGORITHM_VERSION;
+	if (ok) {
+		QImage result = BufferPool::instance().image(header.width, header.height, static_cast<QImage::Format>(header.format));
+		if (header.colorCount > 0) {
+			QVector<QRgb> table(header.colorCount);
+			qint64 tableLen = static_cast<qint64>(table.size()) * static_cast<qint64>(sizeof(QRgb));
+			ok = file.read(reinterpret_cast<char*>(table.data()), tableLen) == tableLen;
+			result.setColorTable(table);
+		}
+		qint64 lineLen = (static_cast<qint64>(result.width()) * result.depth() + 7) / 8;
+		for (int y = 0; ok && y < result.height(); ++y)
+			ok = file.read(reinterpret_cast<char*>(result.scanLine(y)), lineLen) == lineLen;
+		if (ok)
+			image = result;
+	}
+	if (!ok) {
+		file.close();
+		QFile::remove(filePath(key));
+		diskUsed -= it->second->second;
+		disk.erase(it->second);
+		diskIndex.erase(it);
+		return false;
+	}
+	disk.splice(disk.begin(), disk, it->second);
+	return true;
+}
+
+void ResultCache::evict()
+{
+	while (memoryUsed > memoryLimit && !memory.empty()) {
+		memoryUsed -= memory.back().size;
+		memoryIndex.erase(memory.back().key);
+		memory.pop_back();
+	}
+	while (diskUsed > diskLimit && !disk.empty()) {
+		QFile::remove(filePath(disk.back().first));
+		diskUsed -= disk.back().second;
+		diskIndex.erase(disk.back().first);
+		disk.pop_back();
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <QImage>
+#include <QString>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// 
+
+class Hasher
+{
+	quint64 state;
+public:
+	Hasher(quint64 seed = 0x9E3779B97F4A7C15ull) : state(seed) {}
+	Hasher& add(const void* data, std::size_t len);
+	Hasher& add(const char* str);
+	Hasher& add(const QImage& img);
+	template <class T>
+	Hasher& add(const T& value) { return add(&value, sizeof(value)); }
+	quint64 result() const;
+};
+
+//  
+
+class ResultCache
+{
+	struct Entry
+	{
+		quint64 key;
+		QImage image;
+		qint64 size;
+	};
+	std::list<Entry> memory;
+	std::unordered_map<quint64, std::list<Entry>::iterator> memoryIndex;
+	qint64 memoryLimit = 256ll << 20;
+	qint64 memoryUsed = 0;
+
+	std::list<std::pair<quint64, qint64>> disk;
+	std::unordered_map<quint64, std::list<std::pair<quint64, qint64>>::iterator> diskIndex;
+	QString diskPath;
+	qint64 diskLimit = 0;
+	qint64 diskUsed = 0;
+	// ,       
+	std::unordered_set<quint64> writing;
+
+	std::mutex mutex;
+
+	ResultCache() = default;
+	QString filePath(quint64 key) const;
+	void insertMemory(quint64 key, const QImage& image);
+	bool readDisk(quint64 key, QImage& image);
+	void evict();
+public:
+	ResultCache(const ResultCache&) = delete;
+	ResultCache& operator=(const ResultCache&) = delete;
+	static ResultCache& instance();
+	//      - :     
+	static const quint32 ALGORITHM_VERSION = 3;
+
+	void setMemoryLimit(qint64 bytes);
+	void setDiskTier(const QString& path, qint64 bytes);
+	void clear();
+	bool find(quint64 key, QImage& image);
+	void insert(quint64 key, const QImage& image);
+
+	template <class F>
+	QImage lookup(quint64 key, F compute)
+	{
+		QImage result;
+		if (find(key, result))
+			return result;
+		result = compute();
+		insert(key, result);
+		return result;
+	}
+};
@@ -1,13 +1,24 @@
 #include <QtCore/QCoreApplication>
 #include <QImage>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include "Filter.h"
+#include "ResultCache.h"
+#include "ImageIO.h"
+#include "Metrics.h"
+#include "BufferPool.h"
+#include <QFileInfo>
 
 
-void main(int argc, char* argv[])
+int main(int argc, char* argv[])
 {
-    std::string s;
+    std::vector<QString> paths;
+    std::string metrics;
+    ImageFormat format = ImageFormat::Png;
+    int level = -1;
+    qint64 poolLimit = -1;
+    const qint64 writerBytes = 512ll << 20;
 
     QImage img;
     InvertFilter invert;
@@ -23,78 +34,141 @@ void main(int argc, char* argv[])
     SharpnessFilter sharp;
     MoreSharpnessFilter more_sharp;
     PrewittFilter prewitt;
+    CannyFilter canny;
     MedianFilter median;
     HistFilter hist;
+    HistEqualizationFilter equalization;
+    ClaheFilter clahe;
     BaseColor base;
 
     for (int i = 0; i < argc; ++i) {
         if (!strcmp(argv[i], "-p") && (i + 1 < argc)) {
-            s = argv[i + 1];
+            paths.push_back(QString(argv[i + 1]));
+        }
+        if (!strcmp(argv[i], "-f") && (i + 1 < argc)) {
+            if (!strcmp(argv[i + 1], "fastpng"))
+                format = ImageFormat::FastPng;
+            else if (!strcmp(argv[i + 1], "ppm"))
+                format = ImageFormat::Ppm;
+        }
+        if (!strcmp(argv[i], "-z") && (i + 1 < argc)) {
+            level = atoi(argv[i + 1]);
+        }
+        if (!strcmp(argv[i], "-c") && (i + 1 < argc)) {
+            ResultCache::instance().setDiskTier(QString(argv[i + 1]), 1ll << 30);
+        }
+        if (!strcmp(argv[i], "-m") && (i + 1 < argc)) {
+            metrics = argv[i + 1];
+        }
+        if (!strcmp(argv[i], "-b") && (i + 1 < argc)) {
+            poolLimit = atoll(argv[i + 1]) << 20;
         }
     }
-    img.load(QString(s.c_str()));
+    if (poolLimit >= 0)
+        BufferPool::instance().setMemoryLimit(poolLimit);
+    AsyncImageWriter writer(format, level, 0, writerBytes);
+    qint64 frameBytes = 0;
+    ImagePrefetcher images(paths);
+    for (std::size_t n = 0; images.next(img); ++n) {
+        //   ,  ,      
+        frameBytes = std::max<qint64>(frameBytes, img.sizeInBytes());
+        if (poolLimit < 0)
+            BufferPool::instance().setMemoryLimit(std::max<qint64>(256ll << 20, writerBytes + 8 * frameBytes));
+        //    : a/x.png  b/x.png     
+        std::string prefix = paths.size() > 1 ? std::to_string(n) + "_" + QFileInfo(paths[n]).completeBaseName().toStdString() + "_" : "";
+        auto out = [&](const char* file) { return QString((prefix + file).c_str()); };
 
-    img.save(QString("Images\Source.png"));
+        writer.save(img, out("Images\Source.png"));
 
-    Dilatation(
-        img,
-        {
-            {0, 1, 0},
-            {1, 1, 1},
-            {0, 1, 0}
-        }
-    ).save(QString("Images\Dilatation.png"));
+        writer.save(
+            Dilatation(
+                img,
+                {
+                    {0, 1, 0},
+                    {1, 1, 1},
+                    {0, 1, 0}
+                }
+            ),
+            out("Images\Dilatation.png")
+        );
 
-    Erosion(
-        img,
-        {
-            {0, 1, 0},
-            {1, 1, 1},
-            {0, 1, 0}
-        }
-    ).save(QString("Images\Erosion.png"));
+        writer.save(
+            Erosion(
+                img,
+                {
+                    {0, 1, 0},
+                    {1, 1, 1},
+                    {0, 1, 0}
+                }
+            ),
+            out("Images\Erosion.png")
+        );
 
-    Open(
-        img,
-        {
-            {0, 1, 0},
-            {1, 1, 1},
-            {0, 1, 0}
-        }
-    ).save(QString("Images\Open.png"));
+        writer.save(
+            Open(
+                img,
+                {
+                    {0, 1, 0},
+                    {1, 1, 1},
+                    {0, 1, 0}
+                }
+            ),
+            out("Images\Open.png")
+        );
 
-    Close(
-        img,
-        {
-            {0, 1, 0},
-            {1, 1, 1},
-            {0, 1, 0}
-        }
-    ).save(QString("Images\Close.png"));
+        writer.save(
+            Close(
+                img,
+                {
+                    {0, 1, 0},
+                    {1, 1, 1},
+                    {0, 1, 0}
+                }
+            ),
+            out("Images\Close.png")
+        );
 
-    Grad(
-        img,
-        {
-            {0, 1, 0},
-            {1, 1, 1},
-            {0, 1, 0}
-        }
-    ).save(QString("Images\Grad.png"));
+        writer.save(
+            Grad(
+                img,
+                {
+                    {0, 1, 0},
+                    {1, 1, 1},
+                    {0, 1, 0}
+                }
+            ),
+            out("Images\Grad.png")
+        );
 
-    invert.process(img).save(QString("Images\Invert.png"));
-    blur.process(img).save(QString("Images\Blur.png"));
-    gray.process(img).save(QString("Images\GrayScale.png"));
-    gauss.process(img).save(QString("Images\Gauss.png"));
-    sepia.process(img).save(QString("Images\Sepia.png"));
-    bright.process(img).save(QString("Images\Brightness.png"));
-    gray_world.process(img).save(QString("Images\GrayWorld.png"));
-    shift.process(img).save(QString("Images\Shift.png"));
-    glass.process(img).save(QString("Images\Glass.png"));
-    sobel.process(img).save(QString("Images\Sobel.png"));
-    sharp.process(img).save(QString("Images\Sharp.png"));
-    more_sharp.process(img).save(QString("Images\MoreSharp.png"));
-    prewitt.process(img).save(QString("Images\Prewitt.png"));
-    median.process(img).save(QString("Images\Median.png"));
-    hist.process(img).save(QString("Images\Hist.png"));
-    base.process(img).save(QString("Images\BaseColor.png"));
+        writer.save(invert.process(img), out("Images\Invert.png"));
+        writer.save(blur.process(img), out("Images\Blur.png"));
+        writer.save(gray.process(img), out("Images\GrayScale.png"));
+        writer.save(gauss.process(img), out("Images\Gauss.png"));
+        writer.save(sepia.process(img), out("Images\Sepia.png"));
+        writer.save(bright.process(img), out("Images\Brightness.png"));
+        writer.save(gray_world.process(img), out("Images\GrayWorld.png"));
+        writer.save(shift.process(img), out("Images\Shift.png"));
+        writer.save(glass.process(img), out("Images\Glass.png"));
+        writer.save(sobel.process(img), out("Images\Sobel.png"));
+        writer.save(sharp.process(img), out("Images\Sharp.png"));
+        writer.save(more_sharp.process(img), out("Images\MoreSharp.png"));
+        writer.save(prewitt.process(img), out("Images\Prewitt.png"));
+        writer.save(canny.process(img), out("Images\Canny.png"));
+        writer.save(median.process(img), out("Images\Median.png"));
+        writer.save(hist.process(img), out("Images\Hist.png"));
+        writer.save(equalization.process(img), out("Images\Equalization.png"));
+        writer.save(clahe.process(img), out("Images\Clahe.png"));
+        writer.save(base.process(img), out("Images\BaseColor.png"));
+    }
+    writer.wait();
+
+    if (!metrics.empty()) {
+        Metrics::instance().saveJson(QString((metrics + ".json").c_str()));
+        Metrics::instance().savePrometheus(QString((metrics + ".prom").c_str()));
+    }
+    if (std::size_t failed = writer.failures()) {
+        std::cerr << failed << " image(s) could not be saved" << std::endl;
+        return 1;
+    }
+    return 0;
 }